@@ -0,0 +1,319 @@
+#ifndef _DDS_
+#define _DDS_
+
+// Block compressed textures stored in DDS files. BC1 (DXT1) packs each 4x4
+// block of RGB texels into two RGB565 endpoints and sixteen 2 bit indices,
+// 8 bytes instead of 48, and is sampled natively by desktop GPUs. Nothing in
+// here needs a GL context: textures are converted offline and the encoder and
+// decoder can be checked on the CPU.
+
+#include "file_utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// ---- BC1 codec ----
+
+const size_t kBC1BlockBytes = 8;
+
+size_t bc1Size(const int width, const int height) {
+    return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * kBC1BlockBytes;
+}
+
+inline uint16_t packRGB565(const float r, const float g, const float b) {
+    const int r5 = std::min(31, std::max(0, static_cast<int>(r * 31.f / 255.f + 0.5f)));
+    const int g6 = std::min(63, std::max(0, static_cast<int>(g * 63.f / 255.f + 0.5f)));
+    const int b5 = std::min(31, std::max(0, static_cast<int>(b * 31.f / 255.f + 0.5f)));
+    return static_cast<uint16_t>((r5 << 11) | (g6 << 5) | b5);
+}
+
+inline void unpackRGB565(const uint16_t c, int rgb[3]) {
+    const int r5 = (c >> 11) & 31, g6 = (c >> 5) & 63, b5 = c & 31;
+    rgb[0] = (r5 << 3) | (r5 >> 2);
+    rgb[1] = (g6 << 2) | (g6 >> 4);
+    rgb[2] = (b5 << 3) | (b5 >> 2);
+}
+
+// Colors of the block palette; the 3 color + transparent mode is used when c0 <= c1
+inline void bc1Palette(const uint16_t c0, const uint16_t c1, int palette[4][3]) {
+    unpackRGB565(c0, palette[0]);
+    unpackRGB565(c1, palette[1]);
+    for (int k = 0; k < 3; ++k) {
+        if (c0 > c1) {
+            palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+            palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+        } else {
+            palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+            palette[3][k] = 0;
+        }
+    }
+}
+
+// Picks the closest palette entry for every texel; returns the squared error
+inline int bc1AssignIndices(const float texels[16][3], const uint16_t c0, const uint16_t c1, uint32_t& indices) {
+    int palette[4][3];
+    bc1Palette(c0, c1, palette);
+    indices = 0;
+    int totalError = 0;
+    for (int t = 0; t < 16; ++t) {
+        int best = 0, bestError = 1 << 30;
+        for (int p = 0; p < 4; ++p) {
+            int error = 0;
+            for (int k = 0; k < 3; ++k) {
+                const int d = static_cast<int>(texels[t][k]) - palette[p][k];
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                best = p;
+            }
+        }
+        indices |= static_cast<uint32_t>(best) << (2 * t);
+        totalError += bestError;
+    }
+    return totalError;
+}
+
+// Encodes one block of 16 RGB texels (row major). The endpoints are the
+// extremes of the texels along their principal axis, then refined once by a
+// least squares fit on the chosen indices. Only the opaque 4 color mode is used.
+void encodeBC1Block(const float texels[16][3], unsigned char out[kBC1BlockBytes]) {
+    float mean[3] = {0.f, 0.f, 0.f};
+    for (int t = 0; t < 16; ++t)
+        for (int k = 0; k < 3; ++k)
+            mean[k] += texels[t][k] / 16.f;
+    float cov[6] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f}; // xx xy xz yy yz zz
+    for (int t = 0; t < 16; ++t) {
+        const float d[3] = {texels[t][0] - mean[0], texels[t][1] - mean[1], texels[t][2] - mean[2]};
+        cov[0] += d[0] * d[0]; cov[1] += d[0] * d[1]; cov[2] += d[0] * d[2];
+        cov[3] += d[1] * d[1]; cov[4] += d[1] * d[2]; cov[5] += d[2] * d[2];
+    }
+    // Principal axis by power iteration
+    float axis[3] = {1.f, 1.f, 1.f};
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        const float next[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+        const float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+        if (length < 1e-6f)
+            break; // flat block: any axis will do
+        for (int k = 0; k < 3; ++k)
+            axis[k] = next[k] / length;
+    }
+    float minT = 0.f, maxT = 0.f;
+    for (int t = 0; t < 16; ++t) {
+        const float proj = (texels[t][0] - mean[0]) * axis[0] + (texels[t][1] - mean[1]) * axis[1] + (texels[t][2] - mean[2]) * axis[2];
+        minT = std::min(minT, proj);
+        maxT = std::max(maxT, proj);
+    }
+    uint16_t c0 = packRGB565(mean[0] + maxT * axis[0], mean[1] + maxT * axis[1], mean[2] + maxT * axis[2]);
+    uint16_t c1 = packRGB565(mean[0] + minT * axis[0], mean[1] + minT * axis[1], mean[2] + minT * axis[2]);
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    uint32_t indices = 0;
+    if (c0 != c1) {
+        int error = bc1AssignIndices(texels, c0, c1, indices);
+
+        // Least squares endpoints for the current assignment: texel = a * e0 + b * e1
+        const float weights[4] = {1.f, 0.f, 2.f / 3.f, 1.f / 3.f};
+        float aa = 0.f, bb = 0.f, ab = 0.f, ax[3] = {0.f, 0.f, 0.f}, bx[3] = {0.f, 0.f, 0.f};
+        for (int t = 0; t < 16; ++t) {
+            const float a = weights[(indices >> (2 * t)) & 3], b = 1.f - a;
+            aa += a * a; bb += b * b; ab += a * b;
+            for (int k = 0; k < 3; ++k) {
+                ax[k] += a * texels[t][k];
+                bx[k] += b * texels[t][k];
+            }
+        }
+        const float det = aa * bb - ab * ab;
+        if (std::fabs(det) > 1e-6f) {
+            float e0[3], e1[3];
+            for (int k = 0; k < 3; ++k) {
+                e0[k] = (ax[k] * bb - bx[k] * ab) / det;
+                e1[k] = (bx[k] * aa - ax[k] * ab) / det;
+            }
+            uint16_t r0 = packRGB565(e0[0], e0[1], e0[2]);
+            uint16_t r1 = packRGB565(e1[0], e1[1], e1[2]);
+            if (r0 < r1)
+                std::swap(r0, r1);
+            uint32_t refinedIndices = 0;
+            if (r0 != r1 && bc1AssignIndices(texels, r0, r1, refinedIndices) < error) {
+                c0 = r0;
+                c1 = r1;
+                indices = refinedIndices;
+            }
+        }
+    }
+    // c0 == c1 leaves every index at 0, i.e. the endpoint color itself
+    out[0] = static_cast<unsigned char>(c0 & 0xFF);
+    out[1] = static_cast<unsigned char>(c0 >> 8);
+    out[2] = static_cast<unsigned char>(c1 & 0xFF);
+    out[3] = static_cast<unsigned char>(c1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = static_cast<unsigned char>((indices >> (8 * i)) & 0xFF);
+}
+
+// Encodes a whole image with 1 to 4 channels (grey is replicated, alpha is
+// ignored). Partial blocks on the right and bottom borders repeat the last texel.
+std::vector<unsigned char> encodeBC1(const unsigned char* pixels, const int width, const int height, const int channels) {
+    std::vector<unsigned char> blocks(bc1Size(width, height));
+    unsigned char* out = blocks.data();
+    for (int by = 0; by < height; by += 4) {
+        for (int bx = 0; bx < width; bx += 4) {
+            float texels[16][3];
+            for (int t = 0; t < 16; ++t) {
+                const int x = std::min(bx + t % 4, width - 1), y = std::min(by + t / 4, height - 1);
+                const unsigned char* p = pixels + (static_cast<size_t>(y) * width + x) * channels;
+                for (int k = 0; k < 3; ++k)
+                    texels[t][k] = p[channels >= 3 ? k : 0];
+            }
+            encodeBC1Block(texels, out);
+            out += kBC1BlockBytes;
+        }
+    }
+    return blocks;
+}
+
+// Decodes BC1 blocks into tightly packed RGB8 texels
+void decodeBC1(const unsigned char* blocks, const int width, const int height, unsigned char* rgb) {
+    for (int by = 0; by < height; by += 4) {
+        for (int bx = 0; bx < width; bx += 4) {
+            const uint16_t c0 = static_cast<uint16_t>(blocks[0] | (blocks[1] << 8));
+            const uint16_t c1 = static_cast<uint16_t>(blocks[2] | (blocks[3] << 8));
+            const uint32_t indices = blocks[4] | (blocks[5] << 8) | (blocks[6] << 16) | (static_cast<uint32_t>(blocks[7]) << 24);
+            int palette[4][3];
+            bc1Palette(c0, c1, palette);
+            for (int t = 0; t < 16; ++t) {
+                const int x = bx + t % 4, y = by + t / 4;
+                if (x >= width || y >= height)
+                    continue;
+                const int* color = palette[(indices >> (2 * t)) & 3];
+                unsigned char* out = rgb + (static_cast<size_t>(y) * width + x) * 3;
+                for (int k = 0; k < 3; ++k)
+                    out[k] = static_cast<unsigned char>(color[k]);
+            }
+            blocks += kBC1BlockBytes;
+        }
+    }
+}
+
+
+// ---- DDS container (legacy header, DXT1 FourCC, full mip chain) ----
+
+struct DdsPixelFormat {
+    uint32_t size, flags, fourCC, rgbBitCount, rBitMask, gBitMask, bBitMask, aBitMask;
+};
+struct DdsHeader {
+    uint32_t size, flags, height, width, pitchOrLinearSize, depth, mipMapCount, reserved1[11];
+    DdsPixelFormat pixelFormat;
+    uint32_t caps, caps2, caps3, caps4, reserved2;
+};
+static_assert(sizeof(DdsHeader) == 124, "DDS header must be 124 bytes");
+
+const uint32_t kDdsMagic = 0x20534444;   // "DDS "
+const uint32_t kDdsFourCCDXT1 = 0x31545844; // "DXT1"
+const uint32_t kDdsMaxSize = 16384;         // GL_MAX_TEXTURE_SIZE of current desktop GPUs
+
+// Levels of a full mip chain, down to 1x1
+int mipLevelCount(const int width, const int height) {
+    int levels = 1;
+    for (int size = std::max(width, height); size > 1; size /= 2)
+        ++levels;
+    return levels;
+}
+
+// Level l of the chain is max(1, width >> l) x max(1, height >> l)
+struct DdsLevel {
+    int width;
+    int height;
+    const unsigned char* data;
+    size_t size;
+};
+
+// Writes BC1 levels, largest first, as a DDS file
+bool writeDdsBC1(const std::string& filename, const int width, const int height, const std::vector<std::vector<unsigned char>>& levels) {
+    DdsHeader header;
+    std::memset(&header, 0, sizeof(header));
+    header.size = sizeof(DdsHeader);
+    header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // caps, height, width, pixel format, mip count, linear size
+    header.height = height;
+    header.width = width;
+    header.pitchOrLinearSize = static_cast<uint32_t>(bc1Size(width, height));
+    header.mipMapCount = static_cast<uint32_t>(levels.size());
+    header.pixelFormat.size = sizeof(DdsPixelFormat);
+    header.pixelFormat.flags = 0x4; // FourCC
+    header.pixelFormat.fourCC = kDdsFourCCDXT1;
+    header.caps = 0x1000 | (levels.size() > 1 ? 0x8 | 0x400000 : 0); // texture, complex, mipmap
+
+    FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = std::fwrite(&kDdsMagic, sizeof(kDdsMagic), 1, file) == 1 && std::fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const std::vector<unsigned char>& level : levels)
+        written = written && std::fwrite(level.data(), 1, level.size(), file) == level.size();
+    std::fclose(file);
+    return written;
+}
+
+// BC1 DDS file mapped in memory; the levels point straight into the mapping
+class DdsTexture {
+public:
+    bool open(const std::string& filename);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    const std::vector<DdsLevel>& levels() const { return m_levels; }
+
+private:
+    MappedFile m_file;
+    int m_width = 0;
+    int m_height = 0;
+    std::vector<DdsLevel> m_levels;
+};
+
+bool DdsTexture::open(const std::string& filename) {
+    m_levels.clear();
+    if (!m_file.open(filename))
+        return false;
+    const size_t headerSize = sizeof(kDdsMagic) + sizeof(DdsHeader);
+    if (m_file.size() < headerSize)
+        return false;
+    uint32_t magic;
+    DdsHeader header;
+    std::memcpy(&magic, m_file.data(), sizeof(magic));
+    std::memcpy(&header, m_file.data() + sizeof(magic), sizeof(header));
+    if (magic != kDdsMagic || header.size != sizeof(DdsHeader) || !(header.pixelFormat.flags & 0x4) || header.pixelFormat.fourCC != kDdsFourCCDXT1)
+        return false; // only BC1 is produced by the converter
+    if (header.width == 0 || header.height == 0 || header.width > kDdsMaxSize || header.height > kDdsMaxSize)
+        return false;
+
+    m_width = static_cast<int>(header.width);
+    m_height = static_cast<int>(header.height);
+    const uint32_t numLevels = std::max(1u, header.mipMapCount);
+    if (numLevels > static_cast<uint32_t>(mipLevelCount(m_width, m_height)))
+        return false; // more levels than a full chain has
+    size_t offset = headerSize;
+    for (uint32_t l = 0; l < numLevels; ++l) {
+        DdsLevel level;
+        level.width = std::max(1, m_width >> l);
+        level.height = std::max(1, m_height >> l);
+        level.size = bc1Size(level.width, level.height);
+        if (offset + level.size > m_file.size()) {
+            m_levels.clear();
+            return false; // truncated file
+        }
+        level.data = m_file.data() + offset;
+        offset += level.size;
+        m_levels.push_back(level);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef _FILE_WATCHER_
+#define _FILE_WATCHER_
+
+// Reports files modified on disk, for hot reloading. On Linux the directories
+// of the watched files are watched through inotify, so a check is a single
+// non-blocking read; elsewhere, and for files whose directory cannot be
+// watched, the modification times are polled, at most every kPollInterval.
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class FileWatcher {
+public:
+    FileWatcher() = default;
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+    ~FileWatcher() { close(); }
+
+    void add(const std::string& filename);
+    std::vector<std::string> changes(); // watched files modified since the last call, never blocks
+    void close();
+
+    static const std::chrono::milliseconds kPollInterval;
+
+private:
+    static std::string directoryOf(const std::string& filename);
+    static std::string nameOf(const std::string& filename); // without the directory
+    static long long modificationTime(const std::string& filename); // 0 when the file is missing
+
+    struct Watched {
+        std::string filename;
+        long long modified;
+        bool notified; // its directory is watched through inotify, so it is not polled
+    };
+    std::vector<Watched> m_files;
+    std::chrono::steady_clock::time_point m_lastPoll;
+#ifdef __linux__
+    int m_inotify = -1;
+    std::vector<std::pair<int, std::string>> m_directories; // watch descriptor, directory
+#endif
+};
+
+const std::chrono::milliseconds FileWatcher::kPollInterval(250);
+
+std::string FileWatcher::directoryOf(const std::string& filename) {
+    const size_t slash = filename.find_last_of("/\\");
+    return slash == std::string::npos ? std::string(".") : filename.substr(0, slash);
+}
+
+std::string FileWatcher::nameOf(const std::string& filename) {
+    const size_t slash = filename.find_last_of("/\\");
+    return slash == std::string::npos ? filename : filename.substr(slash + 1);
+}
+
+long long FileWatcher::modificationTime(const std::string& filename) {
+#ifdef _WIN32
+    struct _stat64 info;
+    return _stat64(filename.c_str(), &info) == 0 ? static_cast<long long>(info.st_mtime) : 0;
+#else
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<long long>(info.st_mtimespec.tv_sec) * 1000000000ll + info.st_mtimespec.tv_nsec;
+#else
+    return static_cast<long long>(info.st_mtim.tv_sec) * 1000000000ll + info.st_mtim.tv_nsec;
+#endif
+#endif
+}
+
+void FileWatcher::add(const std::string& filename) {
+    for (const Watched& watched : m_files) {
+        if (watched.filename == filename)
+            return;
+    }
+    const std::string directory = directoryOf(filename);
+    m_files.push_back({filename, modificationTime(filename), false});
+#ifdef __linux__
+    if (m_inotify < 0)
+        m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_inotify < 0)
+        return; // falls back to polling
+    for (const std::pair<int, std::string>& watched : m_directories) {
+        if (watched.second == directory) {
+            m_files.back().notified = true;
+            return;
+        }
+    }
+    // editors either rewrite the file or rename a temporary file over it
+    const int wd = inotify_add_watch(m_inotify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+        std::cout << "WARNING: Cannot watch " << directory << ", polling instead: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    m_directories.push_back(std::make_pair(wd, directory));
+    m_files.back().notified = true;
+#endif
+}
+
+std::vector<std::string> FileWatcher::changes() {
+    std::vector<std::string> changed;
+#ifdef __linux__
+    if (m_inotify >= 0) {
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(m_inotify, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + reinterpret_cast<inotify_event*>(p)->len) {
+                const inotify_event* event = reinterpret_cast<inotify_event*>(p);
+                if (event->len == 0)
+                    continue;
+                for (const std::pair<int, std::string>& directory : m_directories) {
+                    if (directory.first != event->wd)
+                        continue;
+                    // split the same way as in add(), so that "name" and "./name" both match
+                    for (const Watched& watched : m_files) {
+                        if (watched.notified && directoryOf(watched.filename) == directory.second && nameOf(watched.filename) == event->name
+                            && std::find(changed.begin(), changed.end(), watched.filename) == changed.end())
+                            changed.push_back(watched.filename);
+                    }
+                }
+            }
+        }
+    }
+#endif
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now - m_lastPoll < kPollInterval)
+        return changed;
+    m_lastPoll = now;
+    for (Watched& watched : m_files) {
+        if (watched.notified)
+            continue;
+        const long long modified = modificationTime(watched.filename);
+        if (modified != 0 && modified != watched.modified) {
+            watched.modified = modified;
+            changed.push_back(watched.filename);
+        }
+    }
+    return changed;
+}
+
+void FileWatcher::close() {
+#ifdef __linux__
+    if (m_inotify >= 0)
+        ::close(m_inotify);
+    m_inotify = -1;
+    m_directories.clear();
+#endif
+    m_files.clear();
+}
+
+#endif
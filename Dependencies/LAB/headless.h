@@ -0,0 +1,254 @@
+#ifndef _HEADLESS_
+#define _HEADLESS_
+
+// Offscreen rendering for machines without a display: an OpenGL context
+// that is not tied to a visible window, and an FBO whose frames are read
+// back asynchronously through a ring of pixel buffer objects.
+//
+// With SOLAR_SYSTEM_USE_EGL defined (and linking against libEGL), the context
+// is created through EGL, surfaceless when EGL_MESA_platform_surfaceless /
+// EGL_KHR_surfaceless_context are available and on a pbuffer otherwise; this
+// runs on llvmpipe without any X server. Without it, a hidden GLFW window is
+// used, which still needs a display but never shows up on screen.
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#ifdef SOLAR_SYSTEM_USE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef SOLAR_SYSTEM_USE_EGL
+EGLDisplay g_eglDisplay = EGL_NO_DISPLAY;
+EGLContext g_eglContext = EGL_NO_CONTEXT;
+EGLSurface g_eglSurface = EGL_NO_SURFACE;
+#else
+GLFWwindow* g_hiddenWindow = nullptr;
+#endif
+
+// Creates an OpenGL 4.5 core context without a visible window, makes it
+// current and loads the GL entry points. Returns false on failure.
+bool createHeadlessContext(const int width, const int height) {
+#ifdef SOLAR_SYSTEM_USE_EGL
+    // Prefer the surfaceless platform: it needs neither X11 nor a DRM device
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+        g_eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (g_eglDisplay == EGL_NO_DISPLAY) {
+        g_eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    EGLint major = 0, minor = 0;
+    if (g_eglDisplay == EGL_NO_DISPLAY || !eglInitialize(g_eglDisplay, &major, &minor)) {
+        std::cerr << "ERROR: Failed to initialize EGL" << std::endl;
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_API);
+
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+        EGL_DEPTH_SIZE, 24,
+        EGL_NONE};
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(g_eglDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        std::cerr << "ERROR: No suitable EGL config" << std::endl;
+        return false;
+    }
+
+    const EGLint contextAttribs[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 4,
+        EGL_CONTEXT_MINOR_VERSION, 5,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE};
+    g_eglContext = eglCreateContext(g_eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (g_eglContext == EGL_NO_CONTEXT) {
+        std::cerr << "ERROR: Failed to create an OpenGL 4.5 EGL context" << std::endl;
+        return false;
+    }
+
+    // Everything is rendered into an FBO, so a surface is only needed when the
+    // driver lacks surfaceless contexts
+    if (!eglMakeCurrent(g_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, g_eglContext)) {
+        const EGLint pbufferAttribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+        g_eglSurface = eglCreatePbufferSurface(g_eglDisplay, config, pbufferAttribs);
+        if (g_eglSurface == EGL_NO_SURFACE || !eglMakeCurrent(g_eglDisplay, g_eglSurface, g_eglSurface, g_eglContext)) {
+            std::cerr << "ERROR: Failed to make the EGL context current" << std::endl;
+            return false;
+        }
+    }
+
+    if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+        std::cerr << "ERROR: Failed to initialize OpenGL context" << std::endl;
+        return false;
+    }
+#else
+    if (!glfwInit()) {
+        std::cerr << "ERROR: Failed to init GLFW" << std::endl;
+        return false;
+    }
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    g_hiddenWindow = glfwCreateWindow(width, height, "Simple Solar System (headless)", nullptr, nullptr);
+    if (!g_hiddenWindow) {
+        std::cerr << "ERROR: Failed to create the hidden window" << std::endl;
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(g_hiddenWindow);
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+        std::cerr << "ERROR: Failed to initialize OpenGL context" << std::endl;
+        return false;
+    }
+#endif
+    return true;
+}
+
+void destroyHeadlessContext() {
+#ifdef SOLAR_SYSTEM_USE_EGL
+    eglMakeCurrent(g_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (g_eglSurface != EGL_NO_SURFACE) eglDestroySurface(g_eglDisplay, g_eglSurface);
+    eglDestroyContext(g_eglDisplay, g_eglContext);
+    eglTerminate(g_eglDisplay);
+#else
+    glfwDestroyWindow(g_hiddenWindow);
+    glfwTerminate();
+#endif
+}
+
+
+// Writes a bottom-up RGBA8 image (as read by glReadPixels) as a binary PPM
+bool writePPM(const std::string& filename, const int width, const int height, const unsigned char* rgba) {
+    FILE* file = std::fopen(filename.c_str(), "wb");
+    if (!file) {
+        std::cerr << "ERROR: Cannot write " << filename << std::endl;
+        return false;
+    }
+    std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(3 * width);
+    for (int y = height - 1; y >= 0; --y) {
+        const unsigned char* src = rgba + 4 * static_cast<size_t>(width) * y;
+        for (int x = 0; x < width; ++x) {
+            row[3 * x] = src[4 * x];
+            row[3 * x + 1] = src[4 * x + 1];
+            row[3 * x + 2] = src[4 * x + 2];
+        }
+        std::fwrite(row.data(), 1, row.size(), file);
+    }
+    std::fclose(file);
+    return true;
+}
+
+
+// Offscreen render target with asynchronous readback. capture() only queues
+// a glReadPixels into the next PBO of the ring; the pixels are mapped and
+// written to disk numPbos frames later, once the GPU is done with them.
+class FrameCapture {
+public:
+    void init(const int width, const int height, const size_t numPbos = 3);
+    void bind() const; // subsequent draws go to the offscreen target
+    void capture(const std::string& filename);
+    void finish(); // writes every pending frame
+    void destroy();
+
+private:
+    void writeOldest();
+
+    int m_width = 0;
+    int m_height = 0;
+    GLuint m_fbo = 0;
+    GLuint m_colorRbo = 0;
+    GLuint m_depthRbo = 0;
+    std::vector<GLuint> m_pbos;
+    std::vector<GLsync> m_fences;
+    std::vector<std::string> m_filenames;
+    size_t m_next = 0;    // slot of the next capture
+    size_t m_pending = 0; // captures queued but not written yet
+};
+
+void FrameCapture::init(const int width, const int height, const size_t numPbos) {
+    m_width = width;
+    m_height = height;
+
+    glCreateRenderbuffers(1, &m_colorRbo);
+    glNamedRenderbufferStorage(m_colorRbo, GL_RGBA8, width, height);
+    glCreateRenderbuffers(1, &m_depthRbo);
+    glNamedRenderbufferStorage(m_depthRbo, GL_DEPTH_COMPONENT24, width, height);
+    glCreateFramebuffers(1, &m_fbo);
+    glNamedFramebufferRenderbuffer(m_fbo, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorRbo);
+    glNamedFramebufferRenderbuffer(m_fbo, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthRbo);
+    if (glCheckNamedFramebufferStatus(m_fbo, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "ERROR: Incomplete offscreen framebuffer" << std::endl;
+    }
+
+    m_pbos.resize(numPbos);
+    m_fences.assign(numPbos, nullptr);
+    m_filenames.resize(numPbos);
+    glCreateBuffers(static_cast<GLsizei>(numPbos), m_pbos.data());
+    for (GLuint pbo : m_pbos) {
+        glNamedBufferStorage(pbo, 4 * static_cast<GLsizeiptr>(width) * height, NULL, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+    }
+}
+
+void FrameCapture::bind() const {
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glViewport(0, 0, m_width, m_height);
+}
+
+void FrameCapture::capture(const std::string& filename) {
+    if (m_pending == m_pbos.size()) {
+        writeOldest(); // the ring is full: the oldest frame had numPbos frames to complete
+    }
+    const size_t slot = m_next;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pbos[slot]);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, 0); // returns immediately, the copy happens on the GPU
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_filenames[slot] = filename;
+    m_next = (slot + 1) % m_pbos.size();
+    ++m_pending;
+}
+
+void FrameCapture::writeOldest() {
+    const size_t slot = (m_next + m_pbos.size() - m_pending) % m_pbos.size();
+    while (glClientWaitSync(m_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(m_fences[slot]);
+    m_fences[slot] = nullptr;
+
+    const GLsizeiptr size = 4 * static_cast<GLsizeiptr>(m_width) * m_height;
+    const unsigned char* pixels = static_cast<const unsigned char*>(glMapNamedBufferRange(m_pbos[slot], 0, size, GL_MAP_READ_BIT));
+    if (pixels) {
+        writePPM(m_filenames[slot], m_width, m_height, pixels);
+        glUnmapNamedBuffer(m_pbos[slot]);
+    }
+    --m_pending;
+}
+
+void FrameCapture::finish() {
+    while (m_pending > 0) {
+        writeOldest();
+    }
+}
+
+void FrameCapture::destroy() {
+    finish();
+    glDeleteBuffers(static_cast<GLsizei>(m_pbos.size()), m_pbos.data());
+    glDeleteFramebuffers(1, &m_fbo);
+    glDeleteRenderbuffers(1, &m_colorRbo);
+    glDeleteRenderbuffers(1, &m_depthRbo);
+    m_pbos.clear();
+}
+
+#endif
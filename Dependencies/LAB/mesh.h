@@ -16,97 +16,400 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <memory>
+#include <cstddef>
+#include <algorithm>
+#include <map>
+#include <iomanip>
+#include <limits>
+#include <tuple>
 
 class Mesh {
 public:
-	void init();
+	// GPU-side arrangement of the vertex attributes
+	enum class VertexLayout {
+		Separate,   // one VBO per attribute (positions, normals, texcoords)
+		Interleaved, // one VBO holding an array of Vertex structs
+		Compressed   // one VBO holding an array of CompressedVertex structs
+	};
+
+	// packed vertex used by the interleaved layout
+	struct Vertex {
+		glm::vec3 position;
+		glm::vec3 normal;
+		glm::vec2 texCoord;
+	};
+
+	// 16-byte vertex used by the compressed layout: snorm16 positions (the mesh
+	// must fit in [-1,1]^3), octahedral snorm16 normals and half-float texcoords
+	struct CompressedVertex {
+		GLshort position[4]; // w is padding to keep the next attribute 4-byte aligned
+		GLshort normal[2];   // octahedral encoding, decoded in the vertex shader
+		GLhalf texCoord[2];
+	};
+
+	// primitive assembly of m_triangleIndices
+	enum class Topology {
+		Triangles, // independent triangles, 3 indices each
+		Strips     // triangle strips separated by kPrimitiveRestartIndex
+	};
+	static const unsigned int kPrimitiveRestartIndex = 0xFFFFFFFF; // becomes 0xFFFF with 16-bit indices (GL_PRIMITIVE_RESTART_FIXED_INDEX)
+	// Vertex buffer bindings: per-vertex data on 0 (1 and 2 hold the normals and
+	// texcoords of the separate layout), per-instance data on kInstanceBinding
+	static const GLuint kInstanceBinding = 3;
+
+	// per-instance data of renderInstanced(), read from vertex binding
+	// kInstanceBinding: the model matrix at attribute locations 3 to 6, the
+	// texture layer at 7 and the normal matrix at 8 to 10
+	struct Instance {
+		glm::mat4 modelMat;
+		glm::vec4 normalMat[3]; // columns of the mat3, padded to vec4
+		GLuint layer;
+		GLuint padding[3]; // keeps the stride a multiple of 16 bytes
+	};
+
+	void init(const VertexLayout layout = VertexLayout::Interleaved);
 	// should properly set up the geometry buffer
-	void render(); // should be called in the main rendering loop
+	void render(const size_t lod = 0); // should be called in the main rendering loop; lod is ignored without a LOD chain. Shaders reading the per-instance attributes need renderInstanced()
+	// Draws every instance with a single glMultiDrawElementsIndirect: instances
+	// are grouped by LOD (lods[i] is the level of instances[i]) and each group
+	// becomes one indirect command
+	void renderInstanced(const std::vector<Instance>& instances, const std::vector<size_t>& lods);
 	void addPosCor(float pos);
 	void addNorCor(float nor);
 	void addTextCor(float col);
 	void addInd(int ind);  
+	void addRestart(); // ends the current strip
+
+	static std::shared_ptr<Mesh> genSphere(const size_t resolution=16, const Topology topology=Topology::Triangles); // should generate a unit sphere, one strip per latitude band with Topology::Strips
+	static std::shared_ptr<Mesh> genIcosphere(const size_t subdivisions=3); // unit sphere from a subdivided icosahedron
+	static std::shared_ptr<Mesh> genCubeSphere(const size_t n=8); // unit sphere from a spherified cube with n x n quads per face
+
+	// Packs several tessellations of the same object, finest first, into one
+	// vertex and one index buffer. errors[i] is the geometric error of level i
+	// relative to the object's bounding radius; all levels must share a topology.
+	static std::shared_ptr<Mesh> genLodChain(const std::vector<std::shared_ptr<Mesh>>& levels, const std::vector<float>& errors);
+
+	// Coarsest level whose error stays under maxPixelError once projected, given
+	// the projected bounding radius in pixels. A coarser level than currentLod
+	// must pass a stricter threshold, so bodies near a switch distance don't pop.
+	size_t selectLod(const float projectedRadiusInPixels, const size_t currentLod, const float maxPixelError = 0.5f) const;
+	inline size_t lodCount() const { return m_lods.empty() ? 1 : m_lods.size(); }
 
-	static std::shared_ptr<Mesh> genSphere(const size_t resolution=16); // should generate a unit sphere
+	size_t triangleCount() const;
+	size_t vertexCount() const { return m_vertexPositions.size()/3; }
+	float computeMaxSphereError() const; // largest distance between the triangles and the unit sphere
+	float computeTriangleAreaRatio() const; // largest over smallest triangle area, 1 for a perfectly uniform tessellation
+
+	// post-transform vertex cache statistics of the current index order, for a
+	// FIFO cache of the given size: ACMR = misses per triangle, ATVR = misses per vertex
+	struct CacheStats {
+		float acmr;
+		float atvr;
+	};
+	CacheStats computeCacheStats(const size_t cacheSize = 32) const;
+
+	// Reorders triangles for post-transform cache locality (Forsyth's linear-speed
+	// algorithm; strips are cut to the cache size and the pieces reordered), then
+	// renumbers vertices in first-use order for fetch locality. Must be called
+	// before init() and genLodChain(); prints the ACMR/ATVR before and after if report is set.
+	void optimize(const bool report = true);
+
+	inline VertexLayout getVertexLayout() const { return m_layout; }
+	inline Topology getTopology() const { return m_topology; }
+	inline GLenum getIndexType() const { return m_indexType; }
+	inline bool hasOctahedralNormals() const { return m_layout == VertexLayout::Compressed; }
 
 // ...
 private:
+	// builds a triangle-list mesh from points on the unit sphere, with the same
+	// equirectangular UV mapping as genSphere; vertices are duplicated where
+	// triangles cross the u=0/1 seam or touch a pole
+	static std::shared_ptr<Mesh> genFromSpherePoints(const std::vector<glm::vec3>& points, const std::vector<unsigned int>& triangles);
+	void reorderStripPieces(); // optimize() for Topology::Strips
+
 	std::vector<float> m_vertexPositions;
 	std::vector<float> m_vertexNormals;
 	std::vector<float> m_vertexTexCoords;
 	std::vector<unsigned int> m_triangleIndices;
 
+	VertexLayout m_layout = VertexLayout::Interleaved;
+	Topology m_topology = Topology::Triangles;
+	GLenum m_indexType = GL_UNSIGNED_INT; // GL_UNSIGNED_SHORT when every index fits in 16 bits
+
+	// range of one LOD level in the shared buffers; indices are relative to baseVertex
+	struct Lod {
+		size_t firstIndex;
+		size_t indexCount;
+		GLint baseVertex;
+		float error;
+	};
+	std::vector<Lod> m_lods; // finest first, empty for a single-level mesh
+
 	GLuint m_vao = 0;
 	GLuint m_posVbo = 0;
 	GLuint m_normalVbo = 0;
 	GLuint m_texCoordVbo = 0;
+	GLuint m_vertexVbo = 0; // interleaved and compressed layouts only
 
 	GLuint m_ibo = 0;
+	GLuint m_instanceVbo = 0;    // refilled by every renderInstanced() call
+	GLuint m_indirectBuffer = 0; // one DrawElementsIndirectCommand per LOD drawn
 //
 
 };
 
+const unsigned int Mesh::kPrimitiveRestartIndex;
+const GLuint Mesh::kInstanceBinding;
+
 void Mesh::addPosCor(float pos){this->m_vertexPositions.push_back(pos);};
 void Mesh::addNorCor(float nor){this->m_vertexNormals.push_back(nor);};
 void Mesh::addTextCor(float textCord){this->m_vertexTexCoords.push_back(textCord);};
 void Mesh::addInd(int ind){this->m_triangleIndices.push_back(ind);};
+void Mesh::addRestart(){this->m_triangleIndices.push_back(kPrimitiveRestartIndex);};
 
 
 
-void Mesh::init() {
+// Maps a unit normal onto the [-1,1]^2 square by projecting it on the
+// octahedron |x|+|y|+|z|=1 and folding the lower hemisphere over the diagonals
+glm::vec2 octahedralEncode(const glm::vec3& n) {
+  glm::vec2 p = glm::vec2(n.x, n.y) / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+  if (n.z < 0.0f) {
+    p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+  }
+  return p;
+}
+
+void Mesh::init(const VertexLayout layout) {
+  m_layout = layout;
+
+  if (m_layout == VertexLayout::Compressed) {
+    for (float c : m_vertexPositions) {
+      if (std::abs(c) > 1.0f) {
+        std::cout << "WARNING: mesh does not fit in [-1,1]^3, using the interleaved layout instead of the compressed one" << std::endl;
+        m_layout = VertexLayout::Interleaved;
+        break;
+      }
+    }
+  }
+
   // Create a single handle that joins together attributes (vertex positions,
   // normals) and connectivity (triangles indices)
   glCreateVertexArrays(1, &m_vao);
-  glBindVertexArray(m_vao);
-  size_t vertexBufferSize = sizeof(float)*m_vertexPositions.size(); // Gather the size of the buffer from the CPU-side vector
+
+  if (m_layout == VertexLayout::Interleaved) {
+    // Pack the three CPU-side arrays into one struct per vertex, so that
+    // fetching a vertex touches a single contiguous 32-byte record
+    const size_t numVertices = m_vertexPositions.size()/3;
+    std::vector<Vertex> vertices(numVertices);
+    for (size_t v = 0; v < numVertices; ++v) {
+      vertices[v].position = glm::vec3(m_vertexPositions[3*v], m_vertexPositions[3*v+1], m_vertexPositions[3*v+2]);
+      vertices[v].normal = glm::vec3(m_vertexNormals[3*v], m_vertexNormals[3*v+1], m_vertexNormals[3*v+2]);
+      vertices[v].texCoord = glm::vec2(m_vertexTexCoords[2*v], m_vertexTexCoords[2*v+1]);
+    }
+
+    glCreateBuffers(1, &m_vertexVbo);
+    glNamedBufferStorage(m_vertexVbo, sizeof(Vertex)*vertices.size(), vertices.data(), 0); // immutable storage, filled once
+    glVertexArrayVertexBuffer(m_vao, 0, m_vertexVbo, 0, sizeof(Vertex)); // single binding point for all attributes
+
+    glEnableVertexArrayAttrib(m_vao, 0);
+    glVertexArrayAttribFormat(m_vao, 0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
+    glVertexArrayAttribBinding(m_vao, 0, 0);
+
+    glEnableVertexArrayAttrib(m_vao, 1);
+    glVertexArrayAttribFormat(m_vao, 1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal));
+    glVertexArrayAttribBinding(m_vao, 1, 0);
+
+    glEnableVertexArrayAttrib(m_vao, 2);
+    glVertexArrayAttribFormat(m_vao, 2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, texCoord));
+    glVertexArrayAttribBinding(m_vao, 2, 0);
+  } else if (m_layout == VertexLayout::Compressed) {
+    // Quantize every attribute to 16 bits: half the size of the Vertex struct.
+    // Positions and texcoords are expanded back to floats by the vertex fetch
+    // (normalized snorm / half float formats), normals by the vertex shader
+    const size_t numVertices = m_vertexPositions.size()/3;
+    std::vector<CompressedVertex> vertices(numVertices);
+    for (size_t v = 0; v < numVertices; ++v) {
+      const glm::vec3 n = glm::normalize(glm::vec3(m_vertexNormals[3*v], m_vertexNormals[3*v+1], m_vertexNormals[3*v+2]));
+      const glm::vec2 oct = octahedralEncode(n);
+      for (int c = 0; c < 3; ++c)
+        vertices[v].position[c] = static_cast<GLshort>(glm::packSnorm1x16(m_vertexPositions[3*v+c]));
+      vertices[v].position[3] = 0;
+      vertices[v].normal[0] = static_cast<GLshort>(glm::packSnorm1x16(oct.x));
+      vertices[v].normal[1] = static_cast<GLshort>(glm::packSnorm1x16(oct.y));
+      vertices[v].texCoord[0] = glm::packHalf1x16(m_vertexTexCoords[2*v]);
+      vertices[v].texCoord[1] = glm::packHalf1x16(m_vertexTexCoords[2*v+1]);
+    }
+
+    glCreateBuffers(1, &m_vertexVbo);
+    glNamedBufferStorage(m_vertexVbo, sizeof(CompressedVertex)*vertices.size(), vertices.data(), 0);
+    glVertexArrayVertexBuffer(m_vao, 0, m_vertexVbo, 0, sizeof(CompressedVertex));
+
+    glEnableVertexArrayAttrib(m_vao, 0);
+    glVertexArrayAttribFormat(m_vao, 0, 3, GL_SHORT, GL_TRUE, offsetof(CompressedVertex, position));
+    glVertexArrayAttribBinding(m_vao, 0, 0);
+
+    glEnableVertexArrayAttrib(m_vao, 1);
+    glVertexArrayAttribFormat(m_vao, 1, 2, GL_SHORT, GL_TRUE, offsetof(CompressedVertex, normal));
+    glVertexArrayAttribBinding(m_vao, 1, 0);
+
+    glEnableVertexArrayAttrib(m_vao, 2);
+    glVertexArrayAttribFormat(m_vao, 2, 2, GL_HALF_FLOAT, GL_FALSE, offsetof(CompressedVertex, texCoord));
+    glVertexArrayAttribBinding(m_vao, 2, 0);
+  } else {
+    size_t vertexBufferSize = sizeof(float)*m_vertexPositions.size(); // Gather the size of the buffer from the CPU-side vector
 
 
-  // Generate a GPU buffer to store the positions of the vertices
-  glCreateBuffers(1, &m_posVbo);
-  glNamedBufferStorage(m_posVbo, vertexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT); // Create a data storage on the GPU
-  glNamedBufferSubData(m_posVbo, 0, vertexBufferSize, m_vertexPositions.data()); // Fill the data storage from a CPU array
-  glBindBuffer(GL_ARRAY_BUFFER, m_posVbo);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), 0);
+    // Generate a GPU buffer to store the positions of the vertices, on binding 0
+    glCreateBuffers(1, &m_posVbo);
+    glNamedBufferStorage(m_posVbo, vertexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT); // Create a data storage on the GPU
+    glNamedBufferSubData(m_posVbo, 0, vertexBufferSize, m_vertexPositions.data()); // Fill the data storage from a CPU array
+    glVertexArrayVertexBuffer(m_vao, 0, m_posVbo, 0, 3*sizeof(GLfloat));
+    glEnableVertexArrayAttrib(m_vao, 0);
+    glVertexArrayAttribFormat(m_vao, 0, 3, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(m_vao, 0, 0);
   
  
-  // Generate a GPU buffer to store the normals of the vertices
-  glCreateBuffers(1, &m_normalVbo);
-  glNamedBufferStorage(m_normalVbo, vertexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT); // Create a data storage on the GPU
-  glNamedBufferSubData(m_normalVbo, 0, vertexBufferSize, m_vertexNormals.data()); // Fill the data storage from a CPU array
-  glBindBuffer(GL_ARRAY_BUFFER, m_normalVbo);
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3*sizeof(GLfloat), 0);
+    // Generate a GPU buffer to store the normals of the vertices, on binding 1
+    glCreateBuffers(1, &m_normalVbo);
+    glNamedBufferStorage(m_normalVbo, vertexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT); // Create a data storage on the GPU
+    glNamedBufferSubData(m_normalVbo, 0, vertexBufferSize, m_vertexNormals.data()); // Fill the data storage from a CPU array
+    glVertexArrayVertexBuffer(m_vao, 1, m_normalVbo, 0, 3*sizeof(GLfloat));
+    glEnableVertexArrayAttrib(m_vao, 1);
+    glVertexArrayAttribFormat(m_vao, 1, 3, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(m_vao, 1, 1);
   
 
-  vertexBufferSize = sizeof(float)*m_vertexTexCoords.size(); // Gather the size of the buffer from the CPU-side vector
+    vertexBufferSize = sizeof(float)*m_vertexTexCoords.size(); // Gather the size of the buffer from the CPU-side vector
 
-  // Generate a GPU buffer to store the colors of the vertices
-  glCreateBuffers(1, &m_texCoordVbo);
-  glNamedBufferStorage(m_texCoordVbo, vertexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT); // Create a data storage on the GPU
-  glNamedBufferSubData(m_texCoordVbo, 0, vertexBufferSize, m_vertexTexCoords.data()); // Fill the data storage from a CPU array
-  glBindBuffer(GL_ARRAY_BUFFER, m_texCoordVbo);
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 2*sizeof(GLfloat), 0);
-
-  glBindVertexArray(0); // deactivate the VAO for now, will be activated at rendering time
+    // Generate a GPU buffer to store the texture coordinates of the vertices, on binding 2
+    glCreateBuffers(1, &m_texCoordVbo);
+    glNamedBufferStorage(m_texCoordVbo, vertexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT); // Create a data storage on the GPU
+    glNamedBufferSubData(m_texCoordVbo, 0, vertexBufferSize, m_vertexTexCoords.data()); // Fill the data storage from a CPU array
+    glVertexArrayVertexBuffer(m_vao, 2, m_texCoordVbo, 0, 2*sizeof(GLfloat));
+    glEnableVertexArrayAttrib(m_vao, 2);
+    glVertexArrayAttribFormat(m_vao, 2, 2, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(m_vao, 2, 2);
+  }
 
   // Same for the index buffer that stores the list of indices of the
-  // triangles forming the mesh
-  size_t indexBufferSize = sizeof(unsigned int)*m_triangleIndices.size();
+  // triangles forming the mesh. 16-bit indices are used whenever every vertex
+  // is addressable below the 0xFFFF restart value, halving the index bandwidth
+  // (LOD levels index relative to their base vertex, so only the largest level counts)
   glCreateBuffers(1, &m_ibo);
-  glNamedBufferStorage(m_ibo, indexBufferSize, NULL, GL_DYNAMIC_STORAGE_BIT);
-  glNamedBufferSubData(m_ibo, 0, indexBufferSize, m_triangleIndices.data());
+  unsigned int maxIndex = 0;
+  for (unsigned int v : m_triangleIndices)
+    if (v != kPrimitiveRestartIndex) maxIndex = std::max(maxIndex, v);
+  if (maxIndex < 0xFFFF) {
+    m_indexType = GL_UNSIGNED_SHORT;
+    std::vector<GLushort> shortIndices(m_triangleIndices.size());
+    for (size_t i = 0; i < m_triangleIndices.size(); ++i)
+      shortIndices[i] = m_triangleIndices[i] == kPrimitiveRestartIndex ? 0xFFFF : static_cast<GLushort>(m_triangleIndices[i]);
+    glNamedBufferStorage(m_ibo, sizeof(GLushort)*shortIndices.size(), shortIndices.data(), 0);
+  } else {
+    m_indexType = GL_UNSIGNED_INT;
+    glNamedBufferStorage(m_ibo, sizeof(unsigned int)*m_triangleIndices.size(), m_triangleIndices.data(), 0);
+  }
+
+  // Per-instance attributes, advancing once per instance on their own binding
+  glCreateBuffers(1, &m_instanceVbo);
+  glCreateBuffers(1, &m_indirectBuffer);
+  glVertexArrayVertexBuffer(m_vao, kInstanceBinding, m_instanceVbo, 0, sizeof(Instance));
+  glVertexArrayBindingDivisor(m_vao, kInstanceBinding, 1);
+  for (GLuint column = 0; column < 4; ++column) {
+    glEnableVertexArrayAttrib(m_vao, 3 + column);
+    glVertexArrayAttribFormat(m_vao, 3 + column, 4, GL_FLOAT, GL_FALSE, offsetof(Instance, modelMat) + column*sizeof(glm::vec4));
+    glVertexArrayAttribBinding(m_vao, 3 + column, kInstanceBinding);
+  }
+  glEnableVertexArrayAttrib(m_vao, 7);
+  glVertexArrayAttribIFormat(m_vao, 7, 1, GL_UNSIGNED_INT, offsetof(Instance, layer));
+  glVertexArrayAttribBinding(m_vao, 7, kInstanceBinding);
+  for (GLuint column = 0; column < 3; ++column) {
+    glEnableVertexArrayAttrib(m_vao, 8 + column);
+    glVertexArrayAttribFormat(m_vao, 8 + column, 3, GL_FLOAT, GL_FALSE, offsetof(Instance, normalMat) + column*sizeof(glm::vec4));
+    glVertexArrayAttribBinding(m_vao, 8 + column, kInstanceBinding);
+  }
 }
 
-void Mesh::render(){
+void Mesh::render(const size_t lod){
+  size_t firstIndex = 0, indexCount = m_triangleIndices.size();
+  GLint baseVertex = 0;
+  if (!m_lods.empty()) {
+    const Lod& level = m_lods[std::min(lod, m_lods.size() - 1)];
+    firstIndex = level.firstIndex;
+    indexCount = level.indexCount;
+    baseVertex = level.baseVertex;
+  }
+  const size_t indexSize = m_indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+  const void* offset = reinterpret_cast<const void*>(firstIndex*indexSize);
+
   glBindVertexArray(m_vao);     // bind the VAO storing geometry data
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo); // bind the IBO storing geometry data
-  glDrawElements(GL_TRIANGLES, m_triangleIndices.size(), GL_UNSIGNED_INT, 0); // Call for rendering: stream the current GPU geometry through the current GPU program
+  if (m_topology == Topology::Strips) {
+    glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX); // restart on the maximum value of the index type
+    glDrawElementsBaseVertex(GL_TRIANGLE_STRIP, indexCount, m_indexType, offset, baseVertex);
+    glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+  } else {
+    glDrawElementsBaseVertex(GL_TRIANGLES, indexCount, m_indexType, offset, baseVertex); // Call for rendering: stream the current GPU geometry through the current GPU program
+  }
   glBindVertexArray(0);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);  
 }
 
+void Mesh::renderInstanced(const std::vector<Instance>& instances, const std::vector<size_t>& lods){
+  if (instances.empty())
+    return;
+
+  // Bucket the instances by LOD so that each level reads a contiguous range
+  std::vector<size_t> lodStart(lodCount() + 1, 0);
+  for (size_t i = 0; i < instances.size(); ++i)
+    ++lodStart[std::min(lods[i], lodCount() - 1) + 1];
+  for (size_t l = 0; l < lodCount(); ++l)
+    lodStart[l+1] += lodStart[l];
+  std::vector<Instance> sorted(instances.size());
+  std::vector<size_t> fill(lodStart.begin(), lodStart.end() - 1);
+  for (size_t i = 0; i < instances.size(); ++i)
+    sorted[fill[std::min(lods[i], lodCount() - 1)]++] = instances[i];
+
+  // layout fixed by the GL spec for indirect indexed draws
+  struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+  };
+  std::vector<DrawElementsIndirectCommand> commands;
+  for (size_t l = 0; l < lodCount(); ++l) {
+    if (lodStart[l+1] == lodStart[l])
+      continue;
+    DrawElementsIndirectCommand command;
+    command.count = static_cast<GLuint>(m_lods.empty() ? m_triangleIndices.size() : m_lods[l].indexCount);
+    command.instanceCount = static_cast<GLuint>(lodStart[l+1] - lodStart[l]);
+    command.firstIndex = static_cast<GLuint>(m_lods.empty() ? 0 : m_lods[l].firstIndex);
+    command.baseVertex = m_lods.empty() ? 0 : m_lods[l].baseVertex;
+    command.baseInstance = static_cast<GLuint>(lodStart[l]);
+    commands.push_back(command);
+  }
+
+  // Orphan and refill the per-frame buffers
+  glNamedBufferData(m_instanceVbo, sizeof(Instance)*sorted.size(), sorted.data(), GL_STREAM_DRAW);
+  glNamedBufferData(m_indirectBuffer, sizeof(DrawElementsIndirectCommand)*commands.size(), commands.data(), GL_STREAM_DRAW);
+
+  glBindVertexArray(m_vao);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ibo);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+  if (m_topology == Topology::Strips) {
+    glEnable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+    glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, m_indexType, 0, static_cast<GLsizei>(commands.size()), 0);
+    glDisable(GL_PRIMITIVE_RESTART_FIXED_INDEX);
+  } else {
+    glMultiDrawElementsIndirect(GL_TRIANGLES, m_indexType, 0, static_cast<GLsizei>(commands.size()), 0);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+  glBindVertexArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
 
 int getIndex(int p, int q, const size_t resolution)
 {
@@ -114,9 +417,10 @@ int getIndex(int p, int q, const size_t resolution)
 };
 
 
-std::shared_ptr<Mesh> Mesh::genSphere(const size_t resolution)
+std::shared_ptr<Mesh> Mesh::genSphere(const size_t resolution, const Topology topology)
 {
 	std::shared_ptr<Mesh> newMesh(new Mesh());
+	newMesh->m_topology = topology;
 
 	int i,j;
 	for (i=0;i<resolution+1;i=i+1){
@@ -140,6 +444,19 @@ std::shared_ptr<Mesh> Mesh::genSphere(const size_t resolution)
     	};
 	}; 
  
+if (topology == Topology::Strips) {
+	// one strip per latitude band, zig-zagging between rows i and i+1 with the
+	// same counter-clockwise winding as the triangle list below
+	for (size_t band=0;band<resolution;++band){
+		for (size_t column=0;column<resolution+1;++column){
+			newMesh->addInd(getIndex(band,column,resolution));
+			newMesh->addInd(getIndex(band+1,column,resolution));
+		};
+		newMesh->addRestart();
+	};
+	return newMesh;
+}
+
 for (i=0;i<resolution;i=i+1){
     for (j=0;j<resolution;j=j+1){
 			newMesh->addInd(getIndex(i,j,resolution));
@@ -154,4 +471,541 @@ for (i=0;i<resolution;i=i+1){
 	return newMesh;
 
 }
+
+
+std::shared_ptr<Mesh> Mesh::genFromSpherePoints(const std::vector<glm::vec3>& points, const std::vector<unsigned int>& triangles)
+{
+	std::shared_ptr<Mesh> newMesh(new Mesh());
+
+	// same parametrization as genSphere: u follows the longitude, v goes from 0 at z=1 to 1 at z=-1
+	std::vector<glm::vec2> uv(points.size());
+	std::vector<bool> isPole(points.size());
+	for (size_t v = 0; v < points.size(); ++v) {
+		float u = static_cast<float>(atan2(points[v].y, points[v].x)/(2*M_PI));
+		if (u < 0.0f) u += 1.0f;
+		uv[v] = glm::vec2(u, static_cast<float>(acos(glm::clamp(points[v].z, -1.0f, 1.0f))/M_PI));
+		isPole[v] = std::abs(points[v].z) > 1.0f - 1e-6f;
+	}
+
+	std::map<std::pair<unsigned int, float>, unsigned int> corners; // (point, u) -> mesh vertex
+	for (size_t t = 0; t < triangles.size(); t += 3) {
+		float u[3];
+		float uMin = 1.0f, uMax = 0.0f;
+		for (int k = 0; k < 3; ++k) {
+			u[k] = uv[triangles[t+k]].x;
+			if (!isPole[triangles[t+k]]) { uMin = std::min(uMin, u[k]); uMax = std::max(uMax, u[k]); }
+		}
+		// a triangle spanning more than half a turn actually crosses the seam
+		float uSum = 0.0f;
+		int numRegular = 0;
+		for (int k = 0; k < 3; ++k) {
+			if (isPole[triangles[t+k]]) continue;
+			if (uMax - uMin > 0.5f && u[k] < 0.5f) u[k] += 1.0f;
+			uSum += u[k];
+			++numRegular;
+		}
+		// the longitude is undefined at the poles: take the one of the opposite edge
+		for (int k = 0; k < 3; ++k)
+			if (isPole[triangles[t+k]]) u[k] = numRegular > 0 ? uSum/numRegular : 0.0f;
+
+		for (int k = 0; k < 3; ++k) {
+			const unsigned int p = triangles[t+k];
+			const std::pair<unsigned int, float> key(p, u[k]);
+			std::map<std::pair<unsigned int, float>, unsigned int>::const_iterator it = corners.find(key);
+			if (it == corners.end()) {
+				it = corners.insert(std::make_pair(key, static_cast<unsigned int>(newMesh->vertexCount()))).first;
+				for (int c = 0; c < 3; ++c) {
+					newMesh->addPosCor(points[p][c]);
+					newMesh->addNorCor(points[p][c]);
+				}
+				newMesh->addTextCor(u[k]);
+				newMesh->addTextCor(uv[p].y);
+			}
+			newMesh->addInd(it->second);
+		}
+	}
+	return newMesh;
+}
+
+
+std::shared_ptr<Mesh> Mesh::genIcosphere(const size_t subdivisions)
+{
+	const float t = static_cast<float>((1.0 + sqrt(5.0))/2.0);
+	std::vector<glm::vec3> points = {
+		{-1, t, 0}, {1, t, 0}, {-1, -t, 0}, {1, -t, 0},
+		{0, -1, t}, {0, 1, t}, {0, -1, -t}, {0, 1, -t},
+		{t, 0, -1}, {t, 0, 1}, {-t, 0, -1}, {-t, 0, 1}};
+	for (glm::vec3& p : points) p = glm::normalize(p);
+	std::vector<unsigned int> triangles = {
+		0, 11, 5,   0, 5, 1,    0, 1, 7,    0, 7, 10,   0, 10, 11,
+		1, 5, 9,    5, 11, 4,   11, 10, 2,  10, 7, 6,   7, 1, 8,
+		3, 9, 4,    3, 4, 2,    3, 2, 6,    3, 6, 8,    3, 8, 9,
+		4, 9, 5,    2, 4, 11,   6, 2, 10,   8, 6, 7,    9, 8, 1};
+
+	// split every triangle in four, sharing the edge midpoints between neighbours
+	for (size_t s = 0; s < subdivisions; ++s) {
+		std::map<std::pair<unsigned int, unsigned int>, unsigned int> midpoints;
+		auto midpoint = [&](unsigned int a, unsigned int b) {
+			const std::pair<unsigned int, unsigned int> edge(std::min(a, b), std::max(a, b));
+			std::map<std::pair<unsigned int, unsigned int>, unsigned int>::const_iterator it = midpoints.find(edge);
+			if (it != midpoints.end()) return it->second;
+			points.push_back(glm::normalize(points[a] + points[b]));
+			const unsigned int m = static_cast<unsigned int>(points.size() - 1);
+			midpoints[edge] = m;
+			return m;
+		};
+		std::vector<unsigned int> refined;
+		refined.reserve(4*triangles.size());
+		for (size_t i = 0; i < triangles.size(); i += 3) {
+			const unsigned int a = triangles[i], b = triangles[i+1], c = triangles[i+2];
+			const unsigned int ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+			const unsigned int children[12] = {a, ab, ca,   b, bc, ab,   c, ca, bc,   ab, bc, ca};
+			refined.insert(refined.end(), children, children + 12);
+		}
+		triangles.swap(refined);
+	}
+	return genFromSpherePoints(points, triangles);
+}
+
+
+std::shared_ptr<Mesh> Mesh::genCubeSphere(const size_t n)
+{
+	// each face: outward axis, and two tangent axes whose cross product is that axis
+	const glm::ivec3 faces[6][3] = {
+		{{1, 0, 0}, {0, 1, 0}, {0, 0, 1}}, {{-1, 0, 0}, {0, 0, 1}, {0, 1, 0}},
+		{{0, 1, 0}, {0, 0, 1}, {1, 0, 0}}, {{0, -1, 0}, {1, 0, 0}, {0, 0, 1}},
+		{{0, 0, 1}, {1, 0, 0}, {0, 1, 0}}, {{0, 0, -1}, {0, 1, 0}, {1, 0, 0}}};
+	const int size = static_cast<int>(n);
+
+	std::vector<glm::vec3> points;
+	std::vector<unsigned int> triangles;
+	std::map<std::tuple<int, int, int>, unsigned int> welded; // cube lattice point -> index, shares the face borders
+	std::vector<unsigned int> grid((n+1)*(n+1));
+	for (int f = 0; f < 6; ++f) {
+		for (int i = 0; i <= size; ++i) {
+			for (int j = 0; j <= size; ++j) {
+				// lattice coordinates in [0,n]^3
+				const glm::ivec3 c = (size*(glm::ivec3(1) + faces[f][0]) + (2*i - size)*faces[f][1] + (2*j - size)*faces[f][2])/2;
+				const std::tuple<int, int, int> key(c.x, c.y, c.z);
+				std::map<std::tuple<int, int, int>, unsigned int>::const_iterator it = welded.find(key);
+				if (it == welded.end()) {
+					// spherified cube mapping: much more uniform than normalizing the cube point
+					const glm::vec3 p = 2.0f*glm::vec3(c)/static_cast<float>(size) - 1.0f;
+					const glm::vec3 p2 = p*p;
+					const glm::vec3 q(p.x*sqrt(1.0f - p2.y/2 - p2.z/2 + p2.y*p2.z/3),
+					                  p.y*sqrt(1.0f - p2.z/2 - p2.x/2 + p2.z*p2.x/3),
+					                  p.z*sqrt(1.0f - p2.x/2 - p2.y/2 + p2.x*p2.y/3));
+					points.push_back(glm::normalize(q));
+					it = welded.insert(std::make_pair(key, static_cast<unsigned int>(points.size() - 1))).first;
+				}
+				grid[i*(n+1) + j] = it->second;
+			}
+		}
+		for (size_t i = 0; i < n; ++i) {
+			for (size_t j = 0; j < n; ++j) {
+				const unsigned int quad[6] = {
+					grid[i*(n+1) + j], grid[(i+1)*(n+1) + j], grid[(i+1)*(n+1) + j+1],
+					grid[i*(n+1) + j], grid[(i+1)*(n+1) + j+1], grid[i*(n+1) + j+1]};
+				triangles.insert(triangles.end(), quad, quad + 6);
+			}
+		}
+	}
+	return genFromSpherePoints(points, triangles);
+}
+
+
+std::shared_ptr<Mesh> Mesh::genLodChain(const std::vector<std::shared_ptr<Mesh>>& levels, const std::vector<float>& errors)
+{
+	std::shared_ptr<Mesh> newMesh(new Mesh());
+	if (levels.empty())
+		return newMesh;
+	newMesh->m_topology = levels.front()->m_topology;
+	for (size_t l = 0; l < levels.size(); ++l) {
+		const Mesh& level = *levels[l];
+		if (level.m_topology != newMesh->m_topology)
+			std::cout << "WARNING: LOD " << l << " does not share the topology of LOD 0" << std::endl;
+		Lod lod;
+		lod.firstIndex = newMesh->m_triangleIndices.size();
+		lod.indexCount = level.m_triangleIndices.size();
+		lod.baseVertex = static_cast<GLint>(newMesh->vertexCount());
+		lod.error = l < errors.size() ? errors[l] : 0.0f;
+		newMesh->m_lods.push_back(lod);
+
+		newMesh->m_vertexPositions.insert(newMesh->m_vertexPositions.end(), level.m_vertexPositions.begin(), level.m_vertexPositions.end());
+		newMesh->m_vertexNormals.insert(newMesh->m_vertexNormals.end(), level.m_vertexNormals.begin(), level.m_vertexNormals.end());
+		newMesh->m_vertexTexCoords.insert(newMesh->m_vertexTexCoords.end(), level.m_vertexTexCoords.begin(), level.m_vertexTexCoords.end());
+		newMesh->m_triangleIndices.insert(newMesh->m_triangleIndices.end(), level.m_triangleIndices.begin(), level.m_triangleIndices.end());
+	}
+	return newMesh;
+}
+
+
+size_t Mesh::selectLod(const float projectedRadiusInPixels, const size_t currentLod, const float maxPixelError) const
+{
+	const float kCoarsenHysteresis = 0.7f; // a coarser level must be this much under the threshold
+	size_t selected = 0;
+	for (size_t l = 0; l < m_lods.size(); ++l) {
+		const float threshold = l > currentLod ? kCoarsenHysteresis*maxPixelError : maxPixelError;
+		if (m_lods[l].error*projectedRadiusInPixels <= threshold)
+			selected = l; // levels are sorted finest first: keep the coarsest one that passes
+	}
+	return selected;
+}
+
+
+size_t Mesh::triangleCount() const {
+  if (m_topology == Topology::Triangles)
+    return m_triangleIndices.size()/3;
+  size_t count = 0, stripLength = 0;
+  for (unsigned int v : m_triangleIndices) {
+    if (v == kPrimitiveRestartIndex) {
+      count += stripLength > 2 ? stripLength - 2 : 0;
+      stripLength = 0;
+    } else {
+      ++stripLength;
+    }
+  }
+  return count + (stripLength > 2 ? stripLength - 2 : 0);
+}
+
+
+Mesh::CacheStats Mesh::computeCacheStats(const size_t cacheSize) const {
+  // A vertex is still in the FIFO if fewer than cacheSize misses happened since it entered
+  const size_t numVertices = m_vertexPositions.size()/3;
+  std::vector<size_t> entryTime(numVertices, 0);
+  std::vector<bool> used(numVertices, false);
+  size_t misses = 0, numUsed = 0;
+  for (unsigned int v : m_triangleIndices) {
+    if (v == kPrimitiveRestartIndex)
+      continue;
+    if (!used[v]) { used[v] = true; ++numUsed; }
+    if (entryTime[v] == 0 || misses + 1 - entryTime[v] > cacheSize) {
+      ++misses;
+      entryTime[v] = misses;
+    }
+  }
+  CacheStats stats;
+  const size_t numTriangles = triangleCount();
+  stats.acmr = numTriangles == 0 ? 0.0f : static_cast<float>(misses)/numTriangles;
+  stats.atvr = numUsed == 0 ? 0.0f : static_cast<float>(misses)/numUsed;
+  return stats;
+}
+
+
+// Point of the triangle abc closest to p (Ericson, Real-Time Collision Detection, 5.1.5)
+glm::vec3 closestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+  const glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+  const float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+  if (d1 <= 0.0f && d2 <= 0.0f) return a;
+  const glm::vec3 bp = p - b;
+  const float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+  if (d3 >= 0.0f && d4 <= d3) return b;
+  const float vc = d1*d4 - d3*d2;
+  if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + d1/(d1 - d3)*ab;
+  const glm::vec3 cp = p - c;
+  const float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+  if (d6 >= 0.0f && d5 <= d6) return c;
+  const float vb = d5*d2 - d1*d6;
+  if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + d2/(d2 - d6)*ac;
+  const float va = d3*d6 - d5*d4;
+  if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (d4 - d3)/((d4 - d3) + (d5 - d6))*(c - b);
+  const float denom = 1.0f/(va + vb + vc);
+  return a + ab*(vb*denom) + ac*(vc*denom);
+}
+
+// Calls f(a, b, c) for every non-degenerate triangle, whatever the topology
+template <typename F>
+void forEachTriangle(const std::vector<float>& positions, const std::vector<unsigned int>& indices, const Mesh::Topology topology, F f) {
+  auto position = [&](unsigned int v) { return glm::vec3(positions[3*v], positions[3*v+1], positions[3*v+2]); };
+  if (topology == Mesh::Topology::Triangles) {
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+      f(position(indices[i]), position(indices[i+1]), position(indices[i+2]));
+    return;
+  }
+  size_t stripStart = 0;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    if (indices[i] == Mesh::kPrimitiveRestartIndex) { stripStart = i + 1; continue; }
+    if (i - stripStart < 2) continue;
+    if ((i - stripStart) % 2 == 0) f(position(indices[i-2]), position(indices[i-1]), position(indices[i]));
+    else f(position(indices[i-1]), position(indices[i-2]), position(indices[i]));
+  }
+}
+
+float Mesh::computeMaxSphereError() const {
+  float maxError = 0.0f;
+  forEachTriangle(m_vertexPositions, m_triangleIndices, m_topology, [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    // the vertices lie on the sphere, so the error peaks at the point closest to the center
+    maxError = std::max(maxError, 1.0f - glm::length(closestPointOnTriangle(glm::vec3(0.0f), a, b, c)));
+  });
+  return maxError;
+}
+
+float Mesh::computeTriangleAreaRatio() const {
+  float minArea = std::numeric_limits<float>::max(), maxArea = 0.0f;
+  forEachTriangle(m_vertexPositions, m_triangleIndices, m_topology, [&](const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    const float area = 0.5f*glm::length(glm::cross(b - a, c - a));
+    if (area <= 1e-8f) return; // collapsed triangles at the poles of the UV sphere
+    minArea = std::min(minArea, area);
+    maxArea = std::max(maxArea, area);
+  });
+  return maxArea > 0.0f ? maxArea/minArea : 0.0f;
+}
+
+// Triangle count vs. geometric error of the three unit sphere generators
+void printSphereTessellationTable() {
+  std::cout << std::left << std::setw(16) << "generator" << std::setw(10) << "level" << std::setw(12) << "vertices"
+            << std::setw(12) << "triangles" << std::setw(14) << "max error" << "area ratio" << std::endl;
+  auto printRow = [](const char* name, size_t level, const std::shared_ptr<Mesh>& mesh) {
+    std::cout << std::left << std::setw(16) << name << std::setw(10) << level << std::setw(12) << mesh->vertexCount()
+              << std::setw(12) << mesh->triangleCount() << std::setw(14) << mesh->computeMaxSphereError() << mesh->computeTriangleAreaRatio() << std::endl;
+  };
+  for (size_t resolution : {8, 16, 32, 64, 128})
+    printRow("genSphere", resolution, Mesh::genSphere(resolution));
+  for (size_t subdivisions : {1, 2, 3, 4, 5})
+    printRow("genIcosphere", subdivisions, Mesh::genIcosphere(subdivisions));
+  for (size_t n : {4, 8, 16, 32, 64})
+    printRow("genCubeSphere", n, Mesh::genCubeSphere(n));
+}
+
+
+// Forsyth's vertex score: recently used vertices and vertices with few
+// remaining triangles are favoured, so that fans get finished off quickly
+const static int kForsythCacheSize = 32;
+
+float forsythVertexScore(const int cachePosition, const int remainingTriangles) {
+  if (remainingTriangles == 0)
+    return -1.0f;
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3)
+      score = 0.75f; // the last triangle's vertices: fixed score so strips are not overly favoured
+    else
+      score = std::pow(1.0f - static_cast<float>(cachePosition - 3)/(kForsythCacheSize - 3), 1.5f);
+  }
+  return score + 2.0f*std::pow(static_cast<float>(remainingTriangles), -0.5f);
+}
+
+void Mesh::optimize(const bool report) {
+  if (!m_lods.empty()) {
+    std::cout << "WARNING: optimize() must run on each LOD level before genLodChain()" << std::endl;
+    return;
+  }
+  const CacheStats before = computeCacheStats();
+  const size_t numVertices = m_vertexPositions.size()/3;
+  const size_t numTriangles = triangleCount();
+  std::vector<unsigned int> inputIndices = m_triangleIndices;
+
+  if (m_topology == Topology::Strips)
+    reorderStripPieces();
+  else {
+    // Vertex -> triangles adjacency; the first activeCount[v] entries of each
+    // range are the triangles of v that are not emitted yet
+    std::vector<int> activeCount(numVertices, 0);
+    for (unsigned int v : m_triangleIndices)
+      ++activeCount[v];
+    std::vector<size_t> adjacencyOffset(numVertices + 1, 0);
+    for (size_t v = 0; v < numVertices; ++v)
+      adjacencyOffset[v+1] = adjacencyOffset[v] + activeCount[v];
+    std::vector<size_t> adjacency(m_triangleIndices.size());
+    std::vector<size_t> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for (size_t t = 0; t < numTriangles; ++t)
+      for (int k = 0; k < 3; ++k)
+        adjacency[fill[m_triangleIndices[3*t+k]]++] = t;
+
+    std::vector<int> cachePosition(numVertices, -1);
+    std::vector<float> vertexScore(numVertices);
+    for (size_t v = 0; v < numVertices; ++v)
+      vertexScore[v] = forsythVertexScore(-1, activeCount[v]);
+    std::vector<float> triangleScore(numTriangles);
+    std::vector<bool> emitted(numTriangles, false);
+    for (size_t t = 0; t < numTriangles; ++t)
+      triangleScore[t] = vertexScore[m_triangleIndices[3*t]] + vertexScore[m_triangleIndices[3*t+1]] + vertexScore[m_triangleIndices[3*t+2]];
+
+    std::vector<unsigned int> newIndices;
+    newIndices.reserve(m_triangleIndices.size());
+    std::vector<unsigned int> cache, newCache;
+    long best = numTriangles > 0 ? std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin() : -1;
+    size_t scan = 0; // fallback cursor when no cached vertex has triangles left
+
+    for (size_t n = 0; n < numTriangles; ++n) {
+      if (best < 0) {
+        while (emitted[scan]) ++scan;
+        best = static_cast<long>(scan);
+      }
+      emitted[best] = true;
+
+      // Emit the triangle and remove it from the active lists of its vertices
+      newCache.clear();
+      for (int k = 0; k < 3; ++k) {
+        const unsigned int v = m_triangleIndices[3*best+k];
+        newIndices.push_back(v);
+        newCache.push_back(v);
+        size_t* first = &adjacency[adjacencyOffset[v]];
+        size_t* last = first + activeCount[v];
+        std::iter_swap(std::find(first, last, static_cast<size_t>(best)), last - 1);
+        --activeCount[v];
+      }
+      // LRU update: the triangle's vertices move to the front
+      for (unsigned int v : cache)
+        if (std::find(newCache.begin(), newCache.begin() + 3, v) == newCache.begin() + 3)
+          newCache.push_back(v);
+
+      for (size_t i = 0; i < newCache.size(); ++i) {
+        const unsigned int v = newCache[i];
+        cachePosition[v] = i < static_cast<size_t>(kForsythCacheSize) ? static_cast<int>(i) : -1;
+        vertexScore[v] = forsythVertexScore(cachePosition[v], activeCount[v]);
+      }
+
+      // Only triangles touching the (old or new) cache changed score
+      best = -1;
+      float bestScore = -1.0f;
+      for (unsigned int v : newCache) {
+        for (int a = 0; a < activeCount[v]; ++a) {
+          const size_t t = adjacency[adjacencyOffset[v] + a];
+          triangleScore[t] = vertexScore[m_triangleIndices[3*t]] + vertexScore[m_triangleIndices[3*t+1]] + vertexScore[m_triangleIndices[3*t+2]];
+          if (triangleScore[t] > bestScore) {
+            bestScore = triangleScore[t];
+            best = static_cast<long>(t);
+          }
+        }
+      }
+
+      if (newCache.size() > static_cast<size_t>(kForsythCacheSize))
+        newCache.resize(kForsythCacheSize);
+      cache.swap(newCache);
+    }
+    m_triangleIndices.swap(newIndices);
+  }
+  // Small meshes can already fit the cache better than the greedy order does
+  if (computeCacheStats().acmr > before.acmr)
+    m_triangleIndices.swap(inputIndices);
+
+  // Renumber the vertices in the order the index buffer first references them
+  const unsigned int unassigned = static_cast<unsigned int>(-1);
+  std::vector<unsigned int> remap(numVertices, unassigned);
+  unsigned int next = 0;
+  for (unsigned int& v : m_triangleIndices) {
+    if (v == kPrimitiveRestartIndex)
+      continue;
+    if (remap[v] == unassigned)
+      remap[v] = next++;
+    v = remap[v];
+  }
+  for (size_t v = 0; v < numVertices; ++v) // unreferenced vertices go last
+    if (remap[v] == unassigned)
+      remap[v] = next++;
+
+  std::vector<float> positions(m_vertexPositions.size()), normals(m_vertexNormals.size()), texCoords(m_vertexTexCoords.size());
+  for (size_t v = 0; v < numVertices; ++v) {
+    std::copy_n(&m_vertexPositions[3*v], 3, &positions[3*remap[v]]);
+    std::copy_n(&m_vertexNormals[3*v], 3, &normals[3*remap[v]]);
+    std::copy_n(&m_vertexTexCoords[2*v], 2, &texCoords[2*remap[v]]);
+  }
+  m_vertexPositions.swap(positions);
+  m_vertexNormals.swap(normals);
+  m_vertexTexCoords.swap(texCoords);
+
+  const CacheStats after = computeCacheStats();
+  if (report)
+    std::cout << "Mesh optimized: " << numTriangles << " triangles, ACMR " << before.acmr << " -> " << after.acmr
+              << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+}
+
+void Mesh::reorderStripPieces() {
+  // A strip longer than the cache evicts its first vertices before the next
+  // strip (the next band of a grid) can reuse them: cut every strip into pieces
+  // short enough that even a piece of misses only leaves the cache, overlapping
+  // by 2 indices so no triangle is lost and starting at even offsets so the
+  // winding is kept
+  const size_t pieceLength = kForsythCacheSize - 2;
+  std::vector<std::pair<size_t, size_t>> pieces; // first index, index count
+  size_t stripStart = 0;
+  for (size_t i = 0; i <= m_triangleIndices.size(); ++i) {
+    if (i < m_triangleIndices.size() && m_triangleIndices[i] != kPrimitiveRestartIndex)
+      continue;
+    for (size_t first = stripStart; first + 2 < i; first += pieceLength - 2)
+      pieces.push_back(std::make_pair(first, std::min(pieceLength, i - first)));
+    stripStart = i + 1;
+  }
+
+  const size_t numVertices = m_vertexPositions.size()/3;
+  std::vector<std::vector<size_t>> vertexPieces(numVertices);
+  for (size_t p = 0; p < pieces.size(); ++p)
+    for (size_t i = pieces[p].first; i < pieces[p].first + pieces[p].second; ++i)
+      if (vertexPieces[m_triangleIndices[i]].empty() || vertexPieces[m_triangleIndices[i]].back() != p)
+        vertexPieces[m_triangleIndices[i]].push_back(p);
+
+  // Greedy order: next is the piece with the most vertices still in a FIFO
+  // cache of kForsythCacheSize, among the pieces sharing a vertex with the last one
+  std::vector<size_t> entryTime(numVertices, 0);
+  size_t misses = 0;
+  auto cached = [&](unsigned int v) { return entryTime[v] != 0 && misses + 1 - entryTime[v] <= static_cast<size_t>(kForsythCacheSize); };
+  std::vector<bool> emitted(pieces.size(), false);
+  std::vector<unsigned int> newIndices;
+  newIndices.reserve(m_triangleIndices.size() + pieces.size());
+  size_t scan = 0; // fallback cursor when no neighbour is left
+  long next = pieces.empty() ? -1 : 0;
+  for (size_t n = 0; n < pieces.size(); ++n) {
+    if (next < 0) {
+      while (emitted[scan]) ++scan;
+      next = static_cast<long>(scan);
+    }
+    const std::pair<size_t, size_t> piece = pieces[next];
+    emitted[next] = true;
+    for (size_t i = piece.first; i < piece.first + piece.second; ++i) {
+      const unsigned int v = m_triangleIndices[i];
+      newIndices.push_back(v);
+      if (!cached(v))
+        entryTime[v] = ++misses;
+    }
+    newIndices.push_back(kPrimitiveRestartIndex);
+
+    next = -1;
+    size_t bestHits = 0;
+    for (size_t i = piece.first; i < piece.first + piece.second; ++i) {
+      for (size_t p : vertexPieces[m_triangleIndices[i]]) {
+        if (emitted[p])
+          continue;
+        size_t hits = 0;
+        for (size_t k = pieces[p].first; k < pieces[p].first + pieces[p].second; ++k)
+          hits += cached(m_triangleIndices[k]) ? 1 : 0;
+        if (next < 0 || hits > bestHits) {
+          bestHits = hits;
+          next = static_cast<long>(p);
+        }
+      }
+    }
+  }
+  if (!newIndices.empty())
+    newIndices.pop_back(); // no restart after the last strip, as the generators do
+  m_triangleIndices.swap(newIndices);
+}
+
+// Vertex cache optimizer regression check on the UV sphere, both topologies:
+// ACMR and ATVR must strictly decrease at every resolution whose bands do not
+// fit the cache already
+bool printVertexCacheCheck() {
+  std::cout << std::left << std::setw(12) << "topology" << std::setw(12) << "resolution" << std::setw(12) << "triangles"
+            << std::setw(24) << "ACMR" << "ATVR" << std::endl;
+  bool passed = true;
+  for (Mesh::Topology topology : {Mesh::Topology::Triangles, Mesh::Topology::Strips}) {
+    for (size_t resolution : {16, 32, 64, 128, 256}) {
+      std::shared_ptr<Mesh> mesh = Mesh::genSphere(resolution, topology);
+      const size_t numTriangles = mesh->triangleCount();
+      const Mesh::CacheStats before = mesh->computeCacheStats();
+      mesh->optimize(false);
+      const Mesh::CacheStats after = mesh->computeCacheStats();
+      std::ostringstream acmr, atvr;
+      acmr << before.acmr << " -> " << after.acmr;
+      atvr << before.atvr << " -> " << after.atvr;
+      std::cout << std::left << std::setw(12) << (topology == Mesh::Topology::Triangles ? "triangles" : "strips") << std::setw(12) << resolution
+                << std::setw(12) << numTriangles << std::setw(24) << acmr.str() << atvr.str() << std::endl;
+      if (mesh->triangleCount() != numTriangles || !(after.acmr < before.acmr) || !(after.atvr < before.atvr)) {
+        std::cout << "ERROR: optimize() did not improve the vertex cache use (or lost triangles)" << std::endl;
+        passed = false;
+      }
+    }
+  }
+  return passed;
+}
 #endif
\ No newline at end of file
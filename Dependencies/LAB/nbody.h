@@ -0,0 +1,1131 @@
+#ifndef _NBODY_
+#define _NBODY_
+
+// Gravitational N-body integrator, by direct summation of the pairwise
+// forces (O(N^2) per evaluation).
+//
+// Bodies are stored as a structure of arrays of floats padded to a multiple
+// of the widest SIMD vector, padding bodies being massless. The accelerations
+// are computed with AVX-512 or AVX2 + FMA when the CPU has them (8 or 16
+// targets per vector against one broadcast source, reciprocal square root
+// refined by one Newton step), and with a scalar loop otherwise. Targets are
+// split in blocks handed out to a pool of worker threads; within a block the
+// sources are visited in tiles that stay in the L1 cache while every target
+// of the block goes over them.
+//
+// Integrators are symplectic, so the energy error stays bounded instead of
+// drifting: leapfrog (kick-drift-kick, second order, one force evaluation
+// per step) and Yoshida's fourth order composition of it (three evaluations
+// per step). Masses are given as gravitational parameters mu = G * mass, so
+// there is no G to choose.
+//
+// For large N, a Barnes-Hut octree brings the cost down to O(N log N):
+// distant groups of bodies act through their center of mass, a node being
+// opened when a target is closer than l / theta + delta to it (l the size of
+// its bodies' bounding box, delta the offset of the center of mass from the
+// box center). The tree is linearized: bodies are sorted by the Morton code
+// of their position (a parallel radix sort), so that every node covers a
+// contiguous range of them, and nodes are stored depth first with the size
+// of their subtree, so a walk is a loop over an array that either enters a
+// node or skips it. The top of the tree is split serially, the subtrees
+// below are built in parallel. Between rebuilds the tree is refit: same
+// topology, new centers of mass and bounds. The walk is done per group of
+// up to kGroupSize nearby bodies (a subtree): they share one walk, against
+// the bounds of the group, whose interaction list then goes through the same
+// SIMD kernels as the direct sum.
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define NBODY_X86_SIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NBODY_TARGET_AVX2
+#define NBODY_TARGET_AVX512
+#else
+#include <cpuid.h>
+#define NBODY_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define NBODY_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#endif
+
+enum class ForceKernel {
+    Auto, // the widest one the CPU has
+    Scalar,
+    Avx2,
+    Avx512
+};
+
+enum class Integrator {
+    Leapfrog,
+    Yoshida
+};
+
+enum class ForceSolver {
+    Direct,   // exact, O(N^2)
+    BarnesHut // approximate, O(N log N)
+};
+
+#ifdef NBODY_X86_SIMD
+// Both the CPU and the OS (which must save the wide registers) are checked
+void cpuidCount(const unsigned int leaf, const unsigned int subleaf, unsigned int info[4]) {
+    info[0] = info[1] = info[2] = info[3] = 0;
+#ifdef _MSC_VER
+    __cpuidex(reinterpret_cast<int*>(info), static_cast<int>(leaf), static_cast<int>(subleaf));
+#else
+    __get_cpuid_count(leaf, subleaf, &info[0], &info[1], &info[2], &info[3]);
+#endif
+}
+
+unsigned long long enabledRegisterStates() {
+    unsigned int info[4];
+    cpuidCount(1, 0, info);
+    if (!(info[2] & (1u << 27))) // OSXSAVE
+        return 0;
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+
+bool cpuHasAvx2() {
+    unsigned int info[4];
+    cpuidCount(1, 0, info);
+    const bool fma = (info[2] & (1u << 12)) != 0;
+    cpuidCount(7, 0, info);
+    const bool avx2 = (info[1] & (1u << 5)) != 0;
+    return fma && avx2 && (enabledRegisterStates() & 0x6) == 0x6; // SSE and AVX states
+}
+
+bool cpuHasAvx512() {
+    unsigned int info[4];
+    cpuidCount(7, 0, info);
+    const bool avx512f = (info[1] & (1u << 16)) != 0;
+    return avx512f && (enabledRegisterStates() & 0xE6) == 0xE6; // and opmask, ZMM0-15 upper halves, ZMM16-31
+}
+#endif
+
+const char* forceKernelName(const ForceKernel kernel) {
+    switch (kernel) {
+    case ForceKernel::Scalar: return "scalar";
+    case ForceKernel::Avx2: return "AVX2";
+    case ForceKernel::Avx512: return "AVX-512";
+    default: return "auto";
+    }
+}
+
+// 21 bit coordinates to a 63 bit Morton code (z y x bits interleaved)
+uint64_t spreadMortonBits(const uint32_t v) {
+    uint64_t x = v & 0x1FFFFF;
+    x = (x | x << 32) & 0x1F00000000FFFFull;
+    x = (x | x << 16) & 0x1F0000FF0000FFull;
+    x = (x | x << 8) & 0x100F00F00F00F00Full;
+    x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+uint64_t mortonCode(const uint32_t x, const uint32_t y, const uint32_t z) {
+    return spreadMortonBits(x) | spreadMortonBits(y) << 1 | spreadMortonBits(z) << 2;
+}
+
+// Force kernels: add to the accelerations of count targets those due to
+// count sources. The SIMD kernels take the targets by vectors, so their
+// count must be a multiple of the vector width
+struct ForceTargets {
+    const float *x, *y, *z;
+    float *ax, *ay, *az;
+    size_t count;
+};
+
+struct ForceSources {
+    const float *x, *y, *z, *mu;
+    size_t count;
+};
+
+class NBody {
+public:
+    NBody() = default;
+    NBody(const NBody&) = delete;
+    NBody& operator=(const NBody&) = delete;
+    ~NBody() { stopWorkers(); }
+
+    void clear();
+    size_t add(const glm::vec3& position, const glm::vec3& velocity, const float mu); // returns the index of the body
+    size_t size() const { return m_size; }
+
+    glm::vec3 position(const size_t i) const { return glm::vec3(m_x[i], m_y[i], m_z[i]); }
+    glm::vec3 velocity(const size_t i) const { return glm::vec3(m_vx[i], m_vy[i], m_vz[i]); }
+    glm::vec3 acceleration(const size_t i) const { return glm::vec3(m_ax[i], m_ay[i], m_az[i]); } // of the latest evaluation
+    float mu(const size_t i) const { return m_mu[i]; }
+
+    // Plummer softening length: the forces are computed with sqrt(r^2 + eps^2)
+    // so that close encounters stay finite. 0 by default
+    void setSoftening(const float eps) { m_eps2 = eps * eps; m_accelerationsValid = false; }
+    void setIntegrator(const Integrator integrator) { m_integrator = integrator; }
+    // Falls back to the best available one when the CPU lacks the requested kernel
+    void setKernel(const ForceKernel kernel);
+    ForceKernel kernel() const { return m_kernel; }
+    // Threads used for the force evaluations, the calling one included. 0 for
+    // one per hardware thread (the default)
+    void setThreads(const unsigned int threads);
+    unsigned int threads() const { return m_threads; }
+
+    // Barnes-Hut opening angle theta: smaller is more accurate and slower, 0
+    // opens every node (same result as the direct sum). Ignored by Direct
+    void setSolver(const ForceSolver solver, const float theta = 0.5f);
+    ForceSolver solver() const { return m_solver; }
+    // Force evaluations between two rebuilds of the tree, refit in between
+    void setTreeRebuildInterval(const int evaluations) { m_rebuildInterval = std::max(1, evaluations); }
+
+    struct TreeStats {
+        size_t nodes = 0;
+        size_t groups = 0;           // tree walks
+        bool rebuilt = false;        // by the latest evaluation, refit otherwise
+        double buildSeconds = 0.0;   // sort and topology, 0 when refit
+        double gatherSeconds = 0.0;  // positions into Morton order when refit, 0 when rebuilt (part of the build)
+        double momentsSeconds = 0.0; // centers of mass and bounds
+        double walkSeconds = 0.0;    // interaction lists and forces
+        uint64_t interactions = 0;   // target-source pairs evaluated
+    };
+    const TreeStats& treeStats() const { return m_treeStats; } // of the latest evaluation with Barnes-Hut
+
+    void step(const double dt);
+    void computeAccelerations();
+    // Total energy (kinetic and potential, times G), in double, for checking
+    // the integrators; O(N^2) and single threaded
+    double energy() const;
+    uint64_t interactions() const { return m_interactions; } // body pairs evaluated so far
+
+    static const size_t kLanes = 16;         // padding, for the widest vectors
+    static const size_t kTargetBlock = 256;  // targets per task
+    static const size_t kSourceTile = 1024;  // sources per tile: 16 KB of x, y, z and mu
+    static const uint32_t kLeafSize = 16;    // bodies per leaf at most, unless they share a Morton code
+    static const uint32_t kGroupSize = 64;   // bodies per walk at most, unless in one leaf
+    static const int kMortonLevels = 21;     // bits per coordinate
+
+private:
+    void resize(const size_t padded);
+    void kick(const float dt);
+    void drift(const float dt);
+    unsigned int threadCount() const;
+
+    // Barnes-Hut tree, nodes in depth first order
+    struct TreeNode {
+        float x, y, z, mu;      // center of mass, total
+        float rcrit2;           // opened for targets closer than sqrt(rcrit2) to the center of mass
+        uint32_t size;          // nodes in the subtree, this one included (1 for leaves): the next one is at index + size
+        uint32_t begin, count;  // bodies, in Morton order
+        glm::vec3 lower, upper; // bounds of the bodies
+    };
+    void computeAccelerationsTree();
+    void buildTree();
+    void sortByMortonCode();
+    void gatherSorted(); // current positions into Morton order
+    bool isTreeFrontier(const uint32_t begin, const uint32_t end, const int level) const;
+    template <typename Visit> void forEachOctant(const uint32_t begin, const uint32_t end, const int level, const Visit& visit) const;
+    void splitTreeTop(const uint32_t begin, const uint32_t end, const int level, std::vector<uint32_t>& frontier) const;
+    void emitTreeTop(const uint32_t begin, const uint32_t end, const int level, std::vector<std::vector<TreeNode>>& subtrees, size_t& next);
+    void buildSubtree(const uint32_t begin, const uint32_t end, const int level, std::vector<TreeNode>& out) const;
+    void computeNodeMoments(const uint32_t k);
+    void computeMoments();
+    void walkTree();
+
+    void parallelFor(const size_t numTasks, const std::function<void(size_t)>& task);
+    void runTasks();
+    void workerLoop(uint64_t seen);
+    void stopWorkers();
+
+    size_t m_size = 0;
+    std::vector<float> m_x, m_y, m_z;
+    std::vector<float> m_vx, m_vy, m_vz;
+    std::vector<float> m_ax, m_ay, m_az;
+    std::vector<float> m_mu;
+    float m_eps2 = 0.0f;
+    bool m_accelerationsValid = false; // at the current positions
+    Integrator m_integrator = Integrator::Leapfrog;
+    ForceKernel m_kernel = ForceKernel::Scalar; // resolved by the first setKernel()
+    bool m_kernelChosen = false;
+    uint64_t m_interactions = 0;
+
+    ForceSolver m_solver = ForceSolver::Direct;
+    float m_theta = 0.5f;
+    int m_rebuildInterval = 4;
+    int m_evaluationsSinceBuild = -1; // -1 when the tree must be rebuilt
+    std::vector<uint64_t> m_codes, m_codesTemp;   // sorted Morton codes
+    std::vector<uint32_t> m_order, m_orderTemp;   // body index of every sorted position
+    std::vector<float> m_sx, m_sy, m_sz, m_smu;   // bodies in Morton order
+    std::vector<float> m_sax, m_say, m_saz;
+    std::vector<TreeNode> m_nodes;
+    std::vector<uint32_t> m_subtreeRoots; // built and refit in parallel
+    std::vector<uint32_t> m_topNodes;     // above them, children before parents
+    std::vector<uint32_t> m_groups;       // nodes walked once for all their bodies
+    TreeStats m_treeStats;
+
+    // worker pool, started by the first parallel evaluation
+    unsigned int m_threads = 0;
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    uint64_t m_generation = 0; // bumped for every parallelFor()
+    size_t m_busyWorkers = 0;
+    bool m_stopping = false;
+    const std::function<void(size_t)>* m_task = nullptr;
+    size_t m_numTasks = 0;
+    std::atomic<size_t> m_nextTask{0};
+};
+
+void NBody::clear() {
+    m_size = 0;
+    resize(0);
+    m_accelerationsValid = false;
+    m_evaluationsSinceBuild = -1;
+}
+
+void NBody::resize(const size_t padded) {
+    for (std::vector<float>* array : {&m_x, &m_y, &m_z, &m_vx, &m_vy, &m_vz, &m_ax, &m_ay, &m_az, &m_mu})
+        array->resize(padded, 0.0f);
+}
+
+size_t NBody::add(const glm::vec3& position, const glm::vec3& velocity, const float mu) {
+    const size_t i = m_size++;
+    resize((m_size + kLanes - 1) / kLanes * kLanes); // padding bodies are massless, at the origin
+    m_x[i] = position.x;
+    m_y[i] = position.y;
+    m_z[i] = position.z;
+    m_vx[i] = velocity.x;
+    m_vy[i] = velocity.y;
+    m_vz[i] = velocity.z;
+    m_mu[i] = mu;
+    m_accelerationsValid = false;
+    m_evaluationsSinceBuild = -1;
+    return i;
+}
+
+void NBody::setKernel(const ForceKernel kernel) {
+    m_kernelChosen = true;
+    m_kernel = ForceKernel::Scalar;
+#ifdef NBODY_X86_SIMD
+    static const bool hasAvx2 = cpuHasAvx2();
+    static const bool hasAvx512 = cpuHasAvx512();
+    if ((kernel == ForceKernel::Auto || kernel == ForceKernel::Avx512) && hasAvx512)
+        m_kernel = ForceKernel::Avx512;
+    else if (kernel != ForceKernel::Scalar && hasAvx2)
+        m_kernel = ForceKernel::Avx2;
+#endif
+}
+
+void NBody::setSolver(const ForceSolver solver, const float theta) {
+    m_solver = solver;
+    m_theta = std::max(0.0f, theta);
+    m_accelerationsValid = false;
+    m_evaluationsSinceBuild = -1;
+}
+
+unsigned int NBody::threadCount() const {
+    return m_threads > 0 ? m_threads : std::max(1u, std::thread::hardware_concurrency());
+}
+
+void NBody::setThreads(const unsigned int threads) {
+    stopWorkers();
+    m_threads = threads;
+}
+
+// ---- Forces ----
+
+void accumulateForcesScalar(const ForceTargets& t, const ForceSources& s, const float eps2) {
+    for (size_t i = 0; i < t.count; ++i) {
+        const float xi = t.x[i], yi = t.y[i], zi = t.z[i];
+        float ax = t.ax[i], ay = t.ay[i], az = t.az[i];
+        for (size_t j = 0; j < s.count; ++j) {
+            const float dx = s.x[j] - xi, dy = s.y[j] - yi, dz = s.z[j] - zi;
+            const float d2 = dx * dx + dy * dy + dz * dz;
+            if (d2 == 0.0f)
+                continue; // the body itself
+            const float inv = 1.0f / std::sqrt(d2 + eps2);
+            const float f = s.mu[j] * inv * inv * inv;
+            ax += dx * f;
+            ay += dy * f;
+            az += dz * f;
+        }
+        t.ax[i] = ax;
+        t.ay[i] = ay;
+        t.az[i] = az;
+    }
+}
+
+#ifdef NBODY_X86_SIMD
+// 8 targets per vector
+NBODY_TARGET_AVX2 void accumulateForcesAvx2(const ForceTargets& t, const ForceSources& s, const float eps2) {
+    const __m256 softening = _mm256_set1_ps(eps2);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    const __m256 zero = _mm256_setzero_ps();
+    for (size_t i = 0; i < t.count; i += 8) {
+        const __m256 xi = _mm256_loadu_ps(t.x + i), yi = _mm256_loadu_ps(t.y + i), zi = _mm256_loadu_ps(t.z + i);
+        __m256 ax = _mm256_loadu_ps(t.ax + i), ay = _mm256_loadu_ps(t.ay + i), az = _mm256_loadu_ps(t.az + i);
+        for (size_t j = 0; j < s.count; ++j) {
+            const __m256 dx = _mm256_sub_ps(_mm256_broadcast_ss(s.x + j), xi);
+            const __m256 dy = _mm256_sub_ps(_mm256_broadcast_ss(s.y + j), yi);
+            const __m256 dz = _mm256_sub_ps(_mm256_broadcast_ss(s.z + j), zi);
+            const __m256 d2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+            const __m256 r2 = _mm256_add_ps(d2, softening);
+            __m256 inv = _mm256_rsqrt_ps(r2); // 12 bits, 23 after the Newton step
+            inv = _mm256_mul_ps(inv, _mm256_fnmadd_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv), threeHalves));
+            __m256 f = _mm256_mul_ps(_mm256_broadcast_ss(s.mu + j), _mm256_mul_ps(inv, _mm256_mul_ps(inv, inv)));
+            f = _mm256_and_ps(f, _mm256_cmp_ps(d2, zero, _CMP_GT_OQ)); // the body itself (NaN when eps is 0) adds nothing
+            ax = _mm256_fmadd_ps(dx, f, ax);
+            ay = _mm256_fmadd_ps(dy, f, ay);
+            az = _mm256_fmadd_ps(dz, f, az);
+        }
+        _mm256_storeu_ps(t.ax + i, ax);
+        _mm256_storeu_ps(t.ay + i, ay);
+        _mm256_storeu_ps(t.az + i, az);
+    }
+}
+
+// 16 targets per vector
+NBODY_TARGET_AVX512 void accumulateForcesAvx512(const ForceTargets& t, const ForceSources& s, const float eps2) {
+    const __m512 softening = _mm512_set1_ps(eps2);
+    const __m512 half = _mm512_set1_ps(0.5f);
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    const __m512 zero = _mm512_setzero_ps();
+    for (size_t i = 0; i < t.count; i += 16) {
+        const __m512 xi = _mm512_loadu_ps(t.x + i), yi = _mm512_loadu_ps(t.y + i), zi = _mm512_loadu_ps(t.z + i);
+        __m512 ax = _mm512_loadu_ps(t.ax + i), ay = _mm512_loadu_ps(t.ay + i), az = _mm512_loadu_ps(t.az + i);
+        for (size_t j = 0; j < s.count; ++j) {
+            const __m512 dx = _mm512_sub_ps(_mm512_set1_ps(s.x[j]), xi);
+            const __m512 dy = _mm512_sub_ps(_mm512_set1_ps(s.y[j]), yi);
+            const __m512 dz = _mm512_sub_ps(_mm512_set1_ps(s.z[j]), zi);
+            const __m512 d2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+            const __m512 r2 = _mm512_add_ps(d2, softening);
+            __m512 inv = _mm512_maskz_rsqrt14_ps(0xFFFF, r2); // 14 bits, 23 after the Newton step
+            inv = _mm512_mul_ps(inv, _mm512_fnmadd_ps(_mm512_mul_ps(half, r2), _mm512_mul_ps(inv, inv), threeHalves));
+            const __mmask16 other = _mm512_cmp_ps_mask(d2, zero, _CMP_GT_OQ); // the body itself adds nothing
+            const __m512 f = _mm512_maskz_mul_ps(other, _mm512_set1_ps(s.mu[j]), _mm512_mul_ps(inv, _mm512_mul_ps(inv, inv)));
+            ax = _mm512_fmadd_ps(dx, f, ax);
+            ay = _mm512_fmadd_ps(dy, f, ay);
+            az = _mm512_fmadd_ps(dz, f, az);
+        }
+        _mm512_storeu_ps(t.ax + i, ax);
+        _mm512_storeu_ps(t.ay + i, ay);
+        _mm512_storeu_ps(t.az + i, az);
+    }
+}
+#endif
+
+void accumulateForces(const ForceKernel kernel, const ForceTargets& targets, const ForceSources& sources, const float eps2) {
+    switch (kernel) {
+#ifdef NBODY_X86_SIMD
+    case ForceKernel::Avx512: accumulateForcesAvx512(targets, sources, eps2); break;
+    case ForceKernel::Avx2: accumulateForcesAvx2(targets, sources, eps2); break;
+#endif
+    default: accumulateForcesScalar(targets, sources, eps2); break;
+    }
+}
+
+void NBody::computeAccelerations() {
+    if (!m_kernelChosen)
+        setKernel(ForceKernel::Auto);
+    if (m_solver == ForceSolver::BarnesHut) {
+        computeAccelerationsTree();
+        return;
+    }
+    const size_t padded = m_x.size();
+    const size_t numBlocks = (padded + kTargetBlock - 1) / kTargetBlock;
+    const std::function<void(size_t)> block = [this, padded](const size_t b) {
+        const size_t t0 = b * kTargetBlock, t1 = std::min(padded, t0 + kTargetBlock); // multiples of kLanes
+        std::fill(m_ax.begin() + t0, m_ax.begin() + t1, 0.0f);
+        std::fill(m_ay.begin() + t0, m_ay.begin() + t1, 0.0f);
+        std::fill(m_az.begin() + t0, m_az.begin() + t1, 0.0f);
+        const ForceTargets targets = {&m_x[t0], &m_y[t0], &m_z[t0], &m_ax[t0], &m_ay[t0], &m_az[t0], t1 - t0};
+        for (size_t s0 = 0; s0 < m_size; s0 += kSourceTile) {
+            const ForceSources sources = {&m_x[s0], &m_y[s0], &m_z[s0], &m_mu[s0], std::min(m_size, s0 + kSourceTile) - s0}; // padding sources are massless: skipped
+            accumulateForces(m_kernel, targets, sources, m_eps2);
+        }
+    };
+    parallelFor(numBlocks, block);
+    m_interactions += static_cast<uint64_t>(m_size) * (m_size > 0 ? m_size - 1 : 0);
+    m_accelerationsValid = true;
+}
+
+// ---- Barnes-Hut ----
+
+void NBody::computeAccelerationsTree() {
+    typedef std::chrono::steady_clock Clock;
+    auto seconds = [](const Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); };
+    m_treeStats = TreeStats();
+    Clock::time_point start = Clock::now();
+    if (m_evaluationsSinceBuild < 0 || m_evaluationsSinceBuild + 1 >= m_rebuildInterval) {
+        buildTree();
+        m_evaluationsSinceBuild = 0;
+        m_treeStats.rebuilt = true;
+        m_treeStats.buildSeconds = seconds(start);
+    } else {
+        gatherSorted();
+        ++m_evaluationsSinceBuild;
+        m_treeStats.gatherSeconds = seconds(start);
+    }
+    start = Clock::now();
+    computeMoments();
+    m_treeStats.momentsSeconds = seconds(start);
+    start = Clock::now();
+    walkTree();
+    m_treeStats.walkSeconds = seconds(start);
+    m_treeStats.nodes = m_nodes.size();
+    m_treeStats.groups = m_groups.size();
+    m_interactions += m_treeStats.interactions;
+    m_accelerationsValid = true;
+}
+
+// Bounds, Morton codes and the parallel LSD radix sort of the codes, 8 bits per pass
+void NBody::sortByMortonCode() {
+    const size_t n = m_size;
+    const size_t numChunks = std::max<size_t>(1, std::min<size_t>(4 * threadCount(), n / 4096));
+    const size_t chunk = (n + numChunks - 1) / numChunks;
+    std::vector<glm::vec3> lows(numChunks, glm::vec3(std::numeric_limits<float>::max())), highs(numChunks, glm::vec3(-std::numeric_limits<float>::max()));
+    parallelFor(numChunks, [&](const size_t c) {
+        for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i) {
+            lows[c] = glm::min(lows[c], position(i));
+            highs[c] = glm::max(highs[c], position(i));
+        }
+    });
+    glm::vec3 low = lows[0], high = highs[0];
+    for (size_t c = 1; c < numChunks; ++c) {
+        low = glm::min(low, lows[c]);
+        high = glm::max(high, highs[c]);
+    }
+    const float side = std::max(std::max(high.x - low.x, high.y - low.y), high.z - low.z);
+    const float scale = side > 0.0f ? static_cast<float>(1u << kMortonLevels) / side : 0.0f;
+    const uint32_t maxCell = (1u << kMortonLevels) - 1;
+    m_codes.resize(n);
+    m_order.resize(n);
+    m_codesTemp.resize(n);
+    m_orderTemp.resize(n);
+    parallelFor(numChunks, [&](const size_t c) {
+        for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i) {
+            const glm::vec3 cell = (position(i) - low) * scale;
+            m_codes[i] = mortonCode(std::min(maxCell, static_cast<uint32_t>(cell.x)), std::min(maxCell, static_cast<uint32_t>(cell.y)), std::min(maxCell, static_cast<uint32_t>(cell.z)));
+            m_order[i] = static_cast<uint32_t>(i);
+        }
+    });
+
+    std::vector<size_t> histograms(numChunks * 256);
+    for (int shift = 0; shift < 3 * kMortonLevels; shift += 8) {
+        parallelFor(numChunks, [&](const size_t c) {
+            size_t* histogram = &histograms[c * 256];
+            std::fill(histogram, histogram + 256, 0);
+            for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i)
+                ++histogram[(m_codes[i] >> shift) & 0xFF];
+        });
+        // offsets by digit then by chunk, so that the sort is stable; a digit shared by every code needs no pass
+        size_t offset = 0;
+        bool trivial = false;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            size_t total = 0;
+            for (size_t c = 0; c < numChunks; ++c) {
+                const size_t count = histograms[c * 256 + digit];
+                histograms[c * 256 + digit] = offset;
+                offset += count;
+                total += count;
+            }
+            trivial = trivial || total == n;
+        }
+        if (trivial)
+            continue;
+        parallelFor(numChunks, [&](const size_t c) {
+            size_t* offsets = &histograms[c * 256];
+            for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i) {
+                const size_t to = offsets[(m_codes[i] >> shift) & 0xFF]++;
+                m_codesTemp[to] = m_codes[i];
+                m_orderTemp[to] = m_order[i];
+            }
+        });
+        m_codes.swap(m_codesTemp);
+        m_order.swap(m_orderTemp);
+    }
+}
+
+void NBody::gatherSorted() {
+    const size_t numChunks = std::max<size_t>(1, std::min<size_t>(4 * threadCount(), m_size / 4096));
+    const size_t chunk = (m_size + numChunks - 1) / numChunks;
+    parallelFor(numChunks, [&](const size_t c) {
+        for (size_t k = c * chunk; k < std::min(m_size, (c + 1) * chunk); ++k) {
+            const uint32_t i = m_order[k];
+            m_sx[k] = m_x[i];
+            m_sy[k] = m_y[i];
+            m_sz[k] = m_z[i];
+            m_smu[k] = m_mu[i];
+        }
+    });
+}
+
+// Subtrees this small (or leaves) are built by one task
+bool NBody::isTreeFrontier(const uint32_t begin, const uint32_t end, const int level) const {
+    const size_t grain = std::max<size_t>(kLeafSize, m_size / (16 * threadCount()));
+    return end - begin <= grain || end - begin <= kLeafSize || level == kMortonLevels;
+}
+
+// Calls visit(childBegin, childEnd) for the non-empty children of a node at level,
+// whose codes share their bits above it: the children are contiguous ranges
+template <typename Visit>
+void NBody::forEachOctant(const uint32_t begin, const uint32_t end, const int level, const Visit& visit) const {
+    const int shift = 3 * (kMortonLevels - 1 - level);
+    for (uint32_t childBegin = begin; childBegin < end;) {
+        const uint64_t octant = (m_codes[childBegin] >> shift) & 7;
+        const uint32_t childEnd = static_cast<uint32_t>(std::partition_point(m_codes.begin() + childBegin, m_codes.begin() + end,
+            [shift, octant](const uint64_t code) { return ((code >> shift) & 7) == octant; }) - m_codes.begin());
+        visit(childBegin, childEnd);
+        childBegin = childEnd;
+    }
+}
+
+void NBody::splitTreeTop(const uint32_t begin, const uint32_t end, const int level, std::vector<uint32_t>& frontier) const {
+    if (isTreeFrontier(begin, end, level)) {
+        frontier.insert(frontier.end(), {begin, end, static_cast<uint32_t>(level)});
+        return;
+    }
+    forEachOctant(begin, end, level, [&](const uint32_t childBegin, const uint32_t childEnd) { splitTreeTop(childBegin, childEnd, level + 1, frontier); });
+}
+
+// Same recursion as splitTreeTop(), copying the subtrees built for its frontier in order
+void NBody::emitTreeTop(const uint32_t begin, const uint32_t end, const int level, std::vector<std::vector<TreeNode>>& subtrees, size_t& next) {
+    if (isTreeFrontier(begin, end, level)) {
+        m_subtreeRoots.push_back(static_cast<uint32_t>(m_nodes.size()));
+        m_nodes.insert(m_nodes.end(), subtrees[next].begin(), subtrees[next].end()); // subtree sizes are relative: nothing to fix
+        std::vector<TreeNode>().swap(subtrees[next++]);
+        return;
+    }
+    const uint32_t node = static_cast<uint32_t>(m_nodes.size());
+    m_nodes.push_back(TreeNode());
+    m_nodes[node].begin = begin;
+    m_nodes[node].count = end - begin;
+    forEachOctant(begin, end, level, [&](const uint32_t childBegin, const uint32_t childEnd) { emitTreeTop(childBegin, childEnd, level + 1, subtrees, next); });
+    m_nodes[node].size = static_cast<uint32_t>(m_nodes.size()) - node;
+    m_topNodes.push_back(node);
+}
+
+void NBody::buildSubtree(const uint32_t begin, const uint32_t end, const int level, std::vector<TreeNode>& out) const {
+    const size_t node = out.size();
+    out.push_back(TreeNode());
+    out[node].begin = begin;
+    out[node].count = end - begin;
+    if (end - begin > kLeafSize && level < kMortonLevels)
+        forEachOctant(begin, end, level, [&](const uint32_t childBegin, const uint32_t childEnd) { buildSubtree(childBegin, childEnd, level + 1, out); });
+    out[node].size = static_cast<uint32_t>(out.size() - node);
+}
+
+void NBody::buildTree() {
+    sortByMortonCode();
+    for (std::vector<float>* array : {&m_sx, &m_sy, &m_sz, &m_smu, &m_sax, &m_say, &m_saz})
+        array->resize(m_size);
+    gatherSorted();
+
+    m_nodes.clear();
+    m_subtreeRoots.clear();
+    m_topNodes.clear();
+    m_groups.clear();
+    if (m_size == 0)
+        return;
+    std::vector<uint32_t> frontier; // begin, end, level of every subtree, depth first
+    splitTreeTop(0, static_cast<uint32_t>(m_size), 0, frontier);
+    std::vector<std::vector<TreeNode>> subtrees(frontier.size() / 3);
+    parallelFor(subtrees.size(), [&](const size_t t) {
+        buildSubtree(frontier[3 * t], frontier[3 * t + 1], static_cast<int>(frontier[3 * t + 2]), subtrees[t]);
+    });
+    size_t next = 0;
+    emitTreeTop(0, static_cast<uint32_t>(m_size), 0, subtrees, next);
+    // the largest nodes of at most kGroupSize bodies, or leaves
+    for (uint32_t k = 0; k < m_nodes.size();) {
+        if (m_nodes[k].count <= kGroupSize || m_nodes[k].size == 1) {
+            m_groups.push_back(k);
+            k += m_nodes[k].size;
+        } else {
+            ++k;
+        }
+    }
+}
+
+// Center of mass, bounds and opening radius, from the bodies of a leaf or the children of a node
+void NBody::computeNodeMoments(const uint32_t k) {
+    TreeNode& node = m_nodes[k];
+    float mu = 0.0f;
+    glm::vec3 weighted(0.0f), lower(std::numeric_limits<float>::max()), upper(-std::numeric_limits<float>::max());
+    if (node.size == 1) {
+        for (uint32_t b = node.begin; b < node.begin + node.count; ++b) {
+            const glm::vec3 p(m_sx[b], m_sy[b], m_sz[b]);
+            mu += m_smu[b];
+            weighted += m_smu[b] * p;
+            lower = glm::min(lower, p);
+            upper = glm::max(upper, p);
+        }
+    } else {
+        for (uint32_t c = k + 1; c < k + node.size; c += m_nodes[c].size) {
+            const TreeNode& child = m_nodes[c];
+            mu += child.mu;
+            weighted += child.mu * glm::vec3(child.x, child.y, child.z);
+            lower = glm::min(lower, child.lower);
+            upper = glm::max(upper, child.upper);
+        }
+    }
+    const glm::vec3 center = 0.5f * (lower + upper);
+    const glm::vec3 com = mu > 0.0f ? weighted / mu : center;
+    const glm::vec3 extent = upper - lower;
+    const float rcrit = m_theta > 0.0f ? std::max(std::max(extent.x, extent.y), extent.z) / m_theta + glm::length(com - center) : std::numeric_limits<float>::infinity();
+    node.x = com.x;
+    node.y = com.y;
+    node.z = com.z;
+    node.mu = mu;
+    node.rcrit2 = rcrit * rcrit;
+    node.lower = lower;
+    node.upper = upper;
+}
+
+void NBody::computeMoments() {
+    parallelFor(m_subtreeRoots.size(), [&](const size_t t) {
+        const uint32_t root = m_subtreeRoots[t];
+        for (uint32_t k = root + m_nodes[root].size; k-- > root;) // children before parents
+            computeNodeMoments(k);
+    });
+    for (const uint32_t k : m_topNodes)
+        computeNodeMoments(k);
+}
+
+// One walk per group, against its bounds: accepted nodes and the bodies of
+// the opened leaves make the interaction list of all its bodies
+void NBody::walkTree() {
+    const size_t groupsPerTask = 16;
+    const size_t numTasks = (m_groups.size() + groupsPerTask - 1) / groupsPerTask;
+    std::atomic<uint64_t> interactions(0);
+    parallelFor(numTasks, [&](const size_t task) {
+        std::vector<float> lx, ly, lz, lmu;
+        uint64_t taskInteractions = 0;
+        for (size_t g = task * groupsPerTask; g < std::min(m_groups.size(), (task + 1) * groupsPerTask); ++g) {
+            const TreeNode& group = m_nodes[m_groups[g]];
+            lx.clear();
+            ly.clear();
+            lz.clear();
+            lmu.clear();
+            for (uint32_t k = 0; k < m_nodes.size();) {
+                const TreeNode& node = m_nodes[k];
+                const glm::vec3 com(node.x, node.y, node.z);
+                const glm::vec3 gap = glm::max(group.lower - com, glm::vec3(0.0f)) + glm::max(com - group.upper, glm::vec3(0.0f));
+                if (glm::dot(gap, gap) > node.rcrit2) {
+                    lx.push_back(node.x);
+                    ly.push_back(node.y);
+                    lz.push_back(node.z);
+                    lmu.push_back(node.mu);
+                    k += node.size;
+                } else if (node.size == 1) {
+                    lx.insert(lx.end(), m_sx.begin() + node.begin, m_sx.begin() + node.begin + node.count);
+                    ly.insert(ly.end(), m_sy.begin() + node.begin, m_sy.begin() + node.begin + node.count);
+                    lz.insert(lz.end(), m_sz.begin() + node.begin, m_sz.begin() + node.begin + node.count);
+                    lmu.insert(lmu.end(), m_smu.begin() + node.begin, m_smu.begin() + node.begin + node.count);
+                    ++k;
+                } else {
+                    ++k; // first child
+                }
+            }
+            const ForceSources sources = {lx.data(), ly.data(), lz.data(), lmu.data(), lx.size()};
+
+            // the bodies of the group by vectors of kLanes, padded with copies of the first one
+            for (uint32_t b0 = group.begin; b0 < group.begin + group.count; b0 += kLanes) {
+                const uint32_t count = std::min<uint32_t>(kLanes, group.begin + group.count - b0);
+                float x[kLanes], y[kLanes], z[kLanes], ax[kLanes] = {}, ay[kLanes] = {}, az[kLanes] = {};
+                for (uint32_t i = 0; i < kLanes; ++i) {
+                    const uint32_t b = b0 + (i < count ? i : 0);
+                    x[i] = m_sx[b];
+                    y[i] = m_sy[b];
+                    z[i] = m_sz[b];
+                }
+                const ForceTargets targets = {x, y, z, ax, ay, az, m_kernel == ForceKernel::Scalar ? count : kLanes};
+                accumulateForces(m_kernel, targets, sources, m_eps2);
+                for (uint32_t i = 0; i < count; ++i) {
+                    m_sax[b0 + i] = ax[i];
+                    m_say[b0 + i] = ay[i];
+                    m_saz[b0 + i] = az[i];
+                }
+                taskInteractions += static_cast<uint64_t>(count) * sources.count;
+            }
+        }
+        interactions += taskInteractions;
+    });
+    m_treeStats.interactions = interactions;
+
+    // back to the order of the bodies
+    const size_t numChunks = std::max<size_t>(1, std::min<size_t>(4 * threadCount(), m_size / 4096));
+    const size_t chunk = (m_size + numChunks - 1) / numChunks;
+    parallelFor(numChunks, [&](const size_t c) {
+        for (size_t k = c * chunk; k < std::min(m_size, (c + 1) * chunk); ++k) {
+            const uint32_t i = m_order[k];
+            m_ax[i] = m_sax[k];
+            m_ay[i] = m_say[k];
+            m_az[i] = m_saz[k];
+        }
+    });
+}
+
+// ---- Integration ----
+
+void NBody::kick(const float dt) {
+    for (size_t i = 0; i < m_size; ++i) {
+        m_vx[i] += m_ax[i] * dt;
+        m_vy[i] += m_ay[i] * dt;
+        m_vz[i] += m_az[i] * dt;
+    }
+}
+
+void NBody::drift(const float dt) {
+    for (size_t i = 0; i < m_size; ++i) {
+        m_x[i] += m_vx[i] * dt;
+        m_y[i] += m_vy[i] * dt;
+        m_z[i] += m_vz[i] * dt;
+    }
+    m_accelerationsValid = false;
+}
+
+void NBody::step(const double dt) {
+    if (m_integrator == Integrator::Leapfrog) {
+        if (!m_accelerationsValid)
+            computeAccelerations();
+        kick(static_cast<float>(0.5 * dt));
+        drift(static_cast<float>(dt));
+        computeAccelerations(); // reused by the first kick of the next step
+        kick(static_cast<float>(0.5 * dt));
+        return;
+    }
+    // Yoshida (1990): drifts c1..c4 and kicks d1..d3, symmetric
+    const double cbrt2 = std::cbrt(2.0);
+    const double w1 = 1.0 / (2.0 - cbrt2), w0 = -cbrt2 / (2.0 - cbrt2);
+    const double c[4] = {0.5 * w1, 0.5 * (w0 + w1), 0.5 * (w0 + w1), 0.5 * w1};
+    const double d[3] = {w1, w0, w1};
+    for (int k = 0; k < 3; ++k) {
+        drift(static_cast<float>(c[k] * dt));
+        computeAccelerations();
+        kick(static_cast<float>(d[k] * dt));
+    }
+    drift(static_cast<float>(c[3] * dt));
+}
+
+double NBody::energy() const {
+    double kinetic = 0.0, potential = 0.0;
+    for (size_t i = 0; i < m_size; ++i) {
+        kinetic += 0.5 * m_mu[i] * (static_cast<double>(m_vx[i]) * m_vx[i] + static_cast<double>(m_vy[i]) * m_vy[i] + static_cast<double>(m_vz[i]) * m_vz[i]);
+        for (size_t j = i + 1; j < m_size; ++j) {
+            const double dx = static_cast<double>(m_x[j]) - m_x[i], dy = static_cast<double>(m_y[j]) - m_y[i], dz = static_cast<double>(m_z[j]) - m_z[i];
+            potential -= static_cast<double>(m_mu[i]) * m_mu[j] / std::sqrt(dx * dx + dy * dy + dz * dz + m_eps2);
+        }
+    }
+    return kinetic + potential;
+}
+
+// ---- Worker pool ----
+// Tasks are taken from a shared counter, by the calling thread too, so a
+// thread that finishes its blocks early takes the next ones.
+
+void NBody::parallelFor(const size_t numTasks, const std::function<void(size_t)>& task) {
+    if (m_workers.empty() && numTasks > 1) {
+        const unsigned int threads = threadCount();
+        for (unsigned int t = 1; t < threads; ++t)
+            m_workers.emplace_back(&NBody::workerLoop, this, m_generation);
+    }
+    if (m_workers.empty() || numTasks < 2) {
+        for (size_t t = 0; t < numTasks; ++t)
+            task(t);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_numTasks = numTasks;
+        m_nextTask = 0;
+        m_busyWorkers = m_workers.size();
+        ++m_generation;
+    }
+    m_wake.notify_all();
+    runTasks();
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return m_busyWorkers == 0; });
+    m_task = nullptr;
+}
+
+void NBody::runTasks() {
+    for (size_t t = m_nextTask++; t < m_numTasks; t = m_nextTask++)
+        (*m_task)(t);
+}
+
+void NBody::workerLoop(uint64_t seen) {
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this, seen] { return m_stopping || m_generation != seen; });
+            if (m_stopping)
+                return;
+            seen = m_generation;
+        }
+        runTasks();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busyWorkers == 0)
+            m_idle.notify_one();
+    }
+}
+
+void NBody::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+    m_workers.clear();
+    m_stopping = false;
+}
+
+// ---- Benchmark ----
+
+// Bodies uniformly distributed in a unit ball, with small random velocities
+void addRandomBodies(NBody& system, const size_t count, const unsigned int seed) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+    while (system.size() < count) {
+        const glm::vec3 p(uniform(random), uniform(random), uniform(random));
+        if (glm::dot(p, p) <= 1.0f)
+            system.add(p, 0.1f * glm::vec3(uniform(random), uniform(random), uniform(random)), 1.0f / count);
+    }
+}
+
+// Body pairs per second of the force kernels (scalar, and AVX2 and AVX-512
+// when the CPU has them) at N = 1k, 10k and 100k, on one thread and on all of
+// them, then the energy error of the integrators on a Kepler orbit.
+// Configurations that would take too long (scalar at 100k bodies) are
+// estimated from the smaller N and skipped. Every kernel run is checked
+// against a double precision direct sum on a sample of the bodies, so the
+// SIMD kernels are checked even where the scalar one is skipped. Returns
+// false if a kernel disagrees with it
+bool printNBodyBenchmark() {
+    typedef std::chrono::steady_clock Clock;
+    const unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+    NBody probe;
+    probe.setKernel(ForceKernel::Auto);
+    const ForceKernel best = probe.kernel();
+    probe.setKernel(ForceKernel::Avx2);
+    const bool hasAvx2 = probe.kernel() == ForceKernel::Avx2;
+    std::cout << "Best force kernel: " << forceKernelName(best) << ", " << hardwareThreads << " hardware threads" << std::endl;
+
+    struct Config {
+        ForceKernel kernel;
+        unsigned int threads;
+        double rate; // pairs per second measured at the previous N
+        bool skipped;
+    };
+    std::vector<ForceKernel> kernels(1, ForceKernel::Scalar);
+    if (hasAvx2 && best != ForceKernel::Avx2)
+        kernels.push_back(ForceKernel::Avx2); // also run on AVX-512 machines
+    if (best != ForceKernel::Scalar)
+        kernels.push_back(best);
+    std::vector<Config> configs;
+    for (const ForceKernel kernel : kernels) {
+        configs.push_back({kernel, 1, 0.0, false});
+        if (hardwareThreads > 1)
+            configs.push_back({kernel, hardwareThreads, 0.0, false});
+    }
+    std::cout << std::left << std::setw(10) << "N";
+    for (const Config& config : configs)
+        std::cout << std::setw(20) << (std::string(forceKernelName(config.kernel)) + " x" + std::to_string(config.threads));
+    std::cout << "(10^9 body pairs per second)" << std::endl;
+
+    bool ok = true;
+    const double kBudget = 10.0; // seconds per configuration and N, at most
+    const float softening = 0.01f;
+    const size_t kSamples = 1000; // reference bodies per N
+    for (const size_t n : {size_t(1000), size_t(10000), size_t(100000)}) {
+        std::cout << std::left << std::setw(10) << n;
+        // direct sum in double on every (n / kSamples)-th body
+        std::vector<size_t> samples;
+        std::vector<glm::dvec3> reference;
+        {
+            NBody system;
+            addRandomBodies(system, n, 1);
+            for (size_t i = 0; i < n; i += std::max<size_t>(1, n / kSamples)) {
+                glm::dvec3 a(0.0);
+                for (size_t j = 0; j < n; ++j) {
+                    const glm::dvec3 d = glm::dvec3(system.position(j)) - glm::dvec3(system.position(i));
+                    const double r2 = glm::dot(d, d) + static_cast<double>(softening) * softening;
+                    a += static_cast<double>(system.mu(j)) / (r2 * std::sqrt(r2)) * d;
+                }
+                samples.push_back(i);
+                reference.push_back(a);
+            }
+        }
+        for (Config& config : configs) {
+            const double pairs = static_cast<double>(n) * (n - 1);
+            config.skipped = config.skipped || (config.rate > 0.0 && pairs / config.rate > kBudget);
+            if (config.skipped) {
+                std::cout << std::setw(20) << "skipped";
+                continue;
+            }
+            NBody system;
+            addRandomBodies(system, n, 1);
+            system.setSoftening(softening);
+            system.setKernel(config.kernel);
+            system.setThreads(config.threads);
+            system.computeAccelerations(); // warm up: starts the workers
+            int iterations = 0;
+            const Clock::time_point start = Clock::now();
+            double elapsed = 0.0;
+            do {
+                system.computeAccelerations();
+                ++iterations;
+                elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            } while (elapsed < 0.5);
+            config.rate = pairs * iterations / elapsed;
+            std::cout << std::setw(20) << std::fixed << std::setprecision(3) << config.rate / 1e9 << std::defaultfloat;
+
+            double maxError = 0.0;
+            for (size_t s = 0; s < samples.size(); ++s)
+                maxError = std::max(maxError, glm::length(glm::dvec3(system.acceleration(samples[s])) - reference[s]) / std::max(glm::length(reference[s]), 1e-6));
+            if (maxError > 1e-3) {
+                std::cout << "MISMATCH: relative error " << maxError << " ";
+                ok = false;
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    // eccentric (e = 0.5) orbit of a massless body, 10 periods at 100 steps per period
+    for (const Integrator integrator : {Integrator::Leapfrog, Integrator::Yoshida}) {
+        NBody kepler;
+        kepler.setIntegrator(integrator);
+        kepler.add(glm::vec3(0.0f), glm::vec3(0.0f), 1.0f);
+        kepler.add(glm::vec3(0.5f, 0.0f, 0.0f), glm::vec3(0.0f, std::sqrt(3.0f), 0.0f), 1e-6f); // perihelion of a = 1
+        const double e0 = kepler.energy();
+        double maxError = 0.0;
+        const int steps = 1000;
+        for (int s = 0; s < steps; ++s) {
+            kepler.step(2.0 * M_PI / 100.0);
+            maxError = std::max(maxError, std::abs((kepler.energy() - e0) / e0));
+        }
+        std::cout << (integrator == Integrator::Leapfrog ? "Leapfrog" : "Yoshida") << " Kepler orbit, 100 steps per period: max relative energy error "
+                  << maxError << ", final position error " << glm::length(kepler.position(1) - kepler.position(0) - glm::vec3(0.5f, 0.0f, 0.0f)) << std::endl;
+    }
+    return ok;
+}
+
+// Asteroid belt: a star of mu 1 at the origin and count - 1 light bodies
+// (1e-3 in total) on circular orbits between radii 2 and 3.3, in a thin disk
+void addAsteroidBelt(NBody& system, const size_t count, const unsigned int seed) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::normal_distribution<float> thickness(0.0f, 0.05f);
+    system.add(glm::vec3(0.0f), glm::vec3(0.0f), 1.0f);
+    const float mu = 1e-3f / std::max<size_t>(1, count - 1);
+    while (system.size() < count) {
+        const float r = 2.0f + 1.3f * uniform(random);
+        const float angle = static_cast<float>(2.0 * M_PI) * uniform(random);
+        const glm::vec3 direction(std::cos(angle), std::sin(angle), 0.0f);
+        system.add(r * direction + glm::vec3(0.0f, 0.0f, thickness(random)), std::sqrt(1.0f / r) * glm::vec3(-direction.y, direction.x, 0.0f), mu);
+    }
+}
+
+// Barnes-Hut against the direct sum: relative acceleration error (median,
+// 99th percentile, max) and time of an evaluation for several opening
+// angles, at N = 20k. Then the cost of the tree steps on asteroid belts of
+// 100k and 1M bodies, and the leapfrog steps per second over one rebuild
+// cycle. Returns false when an error exceeds its bound
+bool printBarnesHutCheck() {
+    typedef std::chrono::steady_clock Clock;
+    auto seconds = [](const Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); };
+    const size_t n = 20000;
+    NBody direct;
+    addRandomBodies(direct, n, 2);
+    direct.setSoftening(0.01f);
+    Clock::time_point start = Clock::now();
+    direct.computeAccelerations();
+    const double directSeconds = seconds(start);
+    std::cout << "N = " << n << " bodies in a ball, direct sum: " << std::fixed << std::setprecision(1) << directSeconds * 1e3 << " ms" << std::defaultfloat << std::endl;
+    std::cout << std::left << std::setw(8) << "theta" << std::setw(14) << "median error" << std::setw(14) << "99% error" << std::setw(14) << "max error"
+              << std::setw(12) << "ms" << std::setw(10) << "speedup" << "sources per body" << std::endl;
+
+    bool ok = true;
+    const struct {
+        float theta;
+        float bound; // on the 99th percentile of the relative error
+    } cases[] = {{0.0f, 1e-4f}, {0.3f, 1e-2f}, {0.5f, 2.5e-2f}, {0.7f, 6e-2f}, {1.0f, 0.12f}};
+    for (const auto& test : cases) {
+        NBody tree;
+        addRandomBodies(tree, n, 2);
+        tree.setSoftening(0.01f);
+        tree.setSolver(ForceSolver::BarnesHut, test.theta);
+        tree.setTreeRebuildInterval(1);
+        int iterations = 0;
+        start = Clock::now();
+        double elapsed = 0.0;
+        do {
+            tree.computeAccelerations();
+            ++iterations;
+            elapsed = seconds(start);
+        } while (elapsed < 0.3);
+        std::vector<float> errors(n);
+        for (size_t i = 0; i < n; ++i)
+            errors[i] = glm::length(tree.acceleration(i) - direct.acceleration(i)) / std::max(glm::length(direct.acceleration(i)), 1e-6f);
+        std::sort(errors.begin(), errors.end());
+        const float p99 = errors[n * 99 / 100];
+        std::cout << std::left << std::setw(8) << test.theta << std::setw(14) << errors[n / 2] << std::setw(14) << p99 << std::setw(14) << errors.back()
+                  << std::setw(12) << std::fixed << std::setprecision(1) << elapsed / iterations * 1e3 << std::setw(10) << directSeconds * iterations / elapsed
+                  << std::setprecision(0) << static_cast<double>(tree.treeStats().interactions) / n << std::defaultfloat
+                  << (p99 > test.bound ? "  FAIL: 99% error above " + std::to_string(test.bound) : std::string()) << std::endl;
+        ok = ok && p99 <= test.bound;
+    }
+
+    const int rebuildInterval = 4;
+    std::cout << "Asteroid belts, theta 0.7, rebuilt every " << rebuildInterval << " evaluations, " << std::max(1u, std::thread::hardware_concurrency())
+              << " threads (ms per evaluation)" << std::endl;
+    std::cout << std::left << std::setw(10) << "N" << std::setw(10) << "build" << std::setw(10) << "moments" << std::setw(10) << "refit"
+              << std::setw(10) << "walk" << std::setw(10) << "steps/s" << std::setw(10) << "nodes" << "sources per body" << std::endl;
+    for (const size_t belt : {size_t(100000), size_t(1000000)}) {
+        NBody system;
+        addAsteroidBelt(system, belt, 3);
+        system.setSoftening(0.001f);
+        system.setSolver(ForceSolver::BarnesHut, 0.7f);
+        system.setTreeRebuildInterval(rebuildInterval);
+        system.computeAccelerations(); // rebuild
+        const NBody::TreeStats built = system.treeStats();
+        system.computeAccelerations(); // refit: gather and moments only
+        const NBody::TreeStats refit = system.treeStats();
+        start = Clock::now(); // one evaluation per leapfrog step: these include exactly one rebuild
+        for (int s = 0; s < rebuildInterval; ++s)
+            system.step(1e-3);
+        const double stepsPerSecond = rebuildInterval / seconds(start);
+        std::cout << std::left << std::setw(10) << belt << std::fixed << std::setprecision(1) << std::setw(10) << built.buildSeconds * 1e3
+                  << std::setw(10) << built.momentsSeconds * 1e3 << std::setw(10) << (refit.gatherSeconds + refit.momentsSeconds) * 1e3
+                  << std::setw(10) << built.walkSeconds * 1e3 << std::setw(10) << std::setprecision(2) << stepsPerSecond << std::setw(10) << built.nodes
+                  << std::setprecision(0) << static_cast<double>(built.interactions) / belt << std::defaultfloat << std::endl;
+    }
+    return ok;
+}
+
+
+#endif
@@ -0,0 +1,482 @@
+#ifndef _PROGRAM_
+#define _PROGRAM_
+
+#include <glad/glad.h>
+#include "file_utils.h"
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+// Loads the content of an ASCII file in a standard C++ string
+std::string file2String(const std::string& filename) {
+    std::ifstream t(filename.c_str());
+    std::stringstream buffer;
+    buffer << t.rdbuf();
+    return buffer.str();
+}
+
+// ---- Shader preprocessing ----
+// Shader sources can #include "file" (relative to the including file, each
+// file at most once per shader) and are specialized by #defines inserted
+// right after #version, so one source yields every permutation a program
+// needs. #line directives keep compiler errors pointing at the right line;
+// their source string number is the index of the file in the returned list.
+
+// Appends filename to out with its includes expanded; defines are inserted
+// after the #version line of the root file (index 0)
+void expandIncludes(const std::string& filename, const size_t index, const std::string& defines, std::vector<std::string>& files, std::string& out) {
+    std::istringstream lines(file2String(filename));
+    const size_t slash = filename.find_last_of("/\\");
+    const std::string directory = slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+    std::string line;
+    int number = 0;
+    while (std::getline(lines, line)) {
+        ++number;
+        const size_t start = line.find_first_not_of(" \t");
+        if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+            const size_t open = line.find('"', start), close = line.find('"', open + 1);
+            if (open == std::string::npos || close == std::string::npos) {
+                std::cout << "ERROR::" << filename << ":" << number << "::MALFORMED_INCLUDE\n" << line << std::endl;
+                out += "\n";
+                continue;
+            }
+            const std::string included = directory + line.substr(open + 1, close - open - 1);
+            if (std::find(files.begin(), files.end(), included) == files.end()) {
+                files.push_back(included);
+                out += "#line 1 " + std::to_string(files.size() - 1) + "\n";
+                expandIncludes(included, files.size() - 1, defines, files, out);
+            }
+            out += "#line " + std::to_string(number + 1) + " " + std::to_string(index) + "\n";
+        } else if (index == 0 && start != std::string::npos && line.compare(start, 8, "#version") == 0) {
+            out += line + "\n" + defines + "#line " + std::to_string(number + 1) + " 0\n";
+        } else {
+            out += line + "\n";
+        }
+    }
+}
+
+// Source of filename with its includes expanded and the defines (e.g. "LIGHTING"
+// or "MAX_LIGHTS 4") added; files receives filename followed by every included file
+std::string preprocessShader(const std::string& filename, const std::vector<std::string>& defines, std::vector<std::string>& files) {
+    std::string defineLines;
+    for (const std::string& define : defines)
+        defineLines += "#define " + define + "\n";
+    files.assign(1, filename);
+    std::string source;
+    expandIncludes(filename, 0, defineLines, files, source);
+    if (!defineLines.empty() && source.find("#version") == std::string::npos)
+        source = defineLines + "#line 1 0\n" + source; // GLSL 1.10, defines can go first
+    return source;
+}
+
+
+// Compiles a shader from its source, before attaching it to a program
+void compileShader(GLuint program, GLenum type, const std::string& shaderSourceString, const std::string& shaderFilename) {
+    GLuint shader = glCreateShader(type); // Create the shader, e.g., a vertex shader to be applied to every single vertex of a mesh
+    const GLchar* shaderSource = (const GLchar*)shaderSourceString.c_str(); // Interface the C++ string through a C pointer
+    glShaderSource(shader, 1, &shaderSource, NULL); // load the vertex shader code
+    glCompileShader(shader);
+
+    int  success;
+    char infoLog[512];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+
+    if (!success)
+    {
+        glGetShaderInfoLog(shader, 512, NULL, infoLog);
+        std::cout << "ERROR::" << shaderFilename << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+    }
+
+
+    glAttachShader(program, shader);
+    glDeleteShader(shader);
+}
+
+// Loads and compile a shader, before attaching it to a program
+void loadShader(GLuint program, GLenum type, const std::string& shaderFilename) {
+    compileShader(program, type, file2String(shaderFilename), shaderFilename); // Loads the shader source from a file to a C++ string
+}
+
+
+// ---- Program binary cache ----
+// Linked programs are saved with glGetProgramBinary and loaded back with
+// glProgramBinary on later launches, skipping GLSL compilation. Entries are
+// keyed by the shader sources and the driver vendor, renderer and version;
+// drivers may still reject a binary (e.g. after an update that kept the
+// version string), in which case the program is compiled from source again.
+
+const uint32_t kProgramBinaryMagic = 0x42504c47; // "GLPB"
+
+struct ProgramBinaryHeader {
+    uint32_t magic;
+    uint32_t binaryFormat;
+    uint64_t key;
+    uint64_t size; // of the binary that follows
+};
+
+std::string programBinaryPath(const std::string& directory, const uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.glbin", static_cast<unsigned long long>(key));
+    return directory + "/" + name;
+}
+
+// Loads a cached binary into program; false when there is no usable entry
+bool loadProgramBinary(const GLuint program, const std::string& directory, const uint64_t key) {
+    MappedFile file;
+    if (!file.open(programBinaryPath(directory, key)) || file.size() < sizeof(ProgramBinaryHeader))
+        return false;
+    ProgramBinaryHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != kProgramBinaryMagic || header.key != key || header.size != file.size() - sizeof(header))
+        return false;
+    glProgramBinary(program, header.binaryFormat, file.data() + sizeof(header), static_cast<GLsizei>(header.size));
+    GLint success = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    return success == GL_TRUE;
+}
+
+bool saveProgramBinary(const GLuint program, const std::string& directory, const uint64_t key) {
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0 || !createDirectory(directory))
+        return false; // e.g. the driver has no binary format
+    std::vector<unsigned char> binary(size);
+    ProgramBinaryHeader header;
+    header.magic = kProgramBinaryMagic;
+    header.key = key;
+    GLenum binaryFormat = 0;
+    GLsizei length = 0;
+    glGetProgramBinary(program, size, &length, &binaryFormat, binary.data());
+    header.binaryFormat = binaryFormat;
+    header.size = static_cast<uint64_t>(length);
+
+    const std::string path = programBinaryPath(directory, key);
+    const std::string tempPath = path + ".tmp";
+    FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 && std::fwrite(binary.data(), 1, length, file) == static_cast<size_t>(length);
+    written = std::fclose(file) == 0 && written;
+    std::remove(path.c_str()); // rename() does not replace on Windows
+    if (!written || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+void check_linking(GLuint program) {
+    int  success;
+    char infoLog[512];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cout << "ERROR::" << "linking shaders" << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+    }
+}
+
+
+// Asks the driver for as many shader compiler threads as it likes, so that
+// compiles and links return immediately and GL_COMPLETION_STATUS_KHR can be
+// polled instead of blocking on the status
+void enableParallelShaderCompile() {
+    if (GLAD_GL_KHR_parallel_shader_compile)
+        glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    else if (GLAD_GL_ARB_parallel_shader_compile)
+        glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+}
+
+
+// GPU program whose uniform locations are looked up once, right after linking,
+// instead of through glGetUniformLocation at every use
+class Program {
+public:
+    enum class RebuildStatus {
+        Idle,    // no rebuild requested
+        Pending, // the driver is still compiling, the previous program is used meanwhile
+        Swapped, // the new program replaced the previous one: uniforms have to be set again
+        Failed   // errors were logged, the previous program is kept
+    };
+
+    void create(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
+    // Reads and preprocesses the source, compiled by link()
+    void addShader(const GLenum type, const std::string& shaderFilename, const std::vector<std::string>& defines = std::vector<std::string>());
+    // Compiles and links, reports errors and caches the location of every active
+    // uniform. With a cache directory, a binary of the same sources linked by
+    // the same driver is loaded instead of compiling, and new links are saved.
+    void link(const std::string& binaryCacheDirectory = "");
+    void destroy();
+
+    // Hot reload: rebuild() reads the sources again and starts compiling them
+    // into a separate program, pollRebuild() swaps it in once linked without
+    // errors. Uniform blocks keep their bindings, plain uniforms do not.
+    bool uses(const std::string& filename) const; // directly or through an #include
+    std::vector<std::string> sourceFiles() const;
+    std::string name() const { return m_shaders.empty() ? std::string() : m_shaders.back().name(); } // of the last shader, e.g. the fragment one
+    void rebuild();
+    RebuildStatus pollRebuild(); // does not block when the driver has parallel shader compilation
+
+    void use() const { glUseProgram(m_id); }
+    inline GLuint id() const { return m_id; }
+
+    // -1 (ignored by glProgramUniform*) when the uniform is unknown or optimized out
+    GLint location(const std::string& name) const;
+    void bindUniformBlock(const std::string& blockName, const GLuint binding);
+
+    // DSA setters: the program does not need to be in use
+    void set(const std::string& name, const GLint value) const { glProgramUniform1i(m_id, location(name), value); }
+    void set(const std::string& name, const float value) const { glProgramUniform1f(m_id, location(name), value); }
+    void set(const std::string& name, const glm::vec2& value) const { glProgramUniform2fv(m_id, location(name), 1, glm::value_ptr(value)); }
+    void set(const std::string& name, const glm::vec3& value) const { glProgramUniform3fv(m_id, location(name), 1, glm::value_ptr(value)); }
+    void set(const std::string& name, const std::vector<GLint>& values) const { glProgramUniform1iv(m_id, location(name), static_cast<GLsizei>(values.size()), values.data()); }
+    void set(const std::string& name, const glm::mat4& value) const { glProgramUniformMatrix4fv(m_id, location(name), 1, GL_FALSE, glm::value_ptr(value)); }
+
+private:
+    struct Shader {
+        GLenum type;
+        std::string filename;
+        std::vector<std::string> defines;
+        std::string source; // preprocessed
+        std::vector<std::string> files; // filename and its includes, by #line source string number
+
+        void load() { source = preprocessShader(filename, defines, files); }
+        std::string name() const;  // filename and defines
+        std::string label() const; // name and included files, for error messages
+    };
+
+    static uint64_t binaryKey(const std::vector<Shader>& shaders);
+    void cacheUniformLocations();
+    void applyUniformBlockBindings() const;
+
+    GLuint m_id = 0;
+    std::vector<Shader> m_shaders;
+    std::string m_binaryCacheDirectory;
+    std::unordered_map<std::string, GLint> m_uniformLocations;
+    std::vector<std::pair<std::string, GLuint>> m_uniformBlockBindings; // restored after a rebuild
+
+    // rebuild in flight
+    GLuint m_pendingId = 0;
+    std::vector<GLuint> m_pendingShaders;
+    std::vector<Shader> m_pendingSources;
+};
+
+void Program::create() {
+    m_id = glCreateProgram();
+}
+
+void Program::addShader(const GLenum type, const std::string& shaderFilename, const std::vector<std::string>& defines) {
+    Shader shader;
+    shader.type = type;
+    shader.filename = shaderFilename;
+    shader.defines = defines;
+    shader.load();
+    m_shaders.push_back(shader);
+}
+
+std::string Program::Shader::name() const {
+    std::string text = filename;
+    for (const std::string& define : defines)
+        text += (&define == &defines.front() ? " [" : " ") + define;
+    if (!defines.empty())
+        text += "]";
+    return text;
+}
+
+std::string Program::Shader::label() const {
+    std::string text = name();
+    for (size_t f = 1; f < files.size(); ++f)
+        text += "\n  source " + std::to_string(f) + ": " + files[f];
+    return text;
+}
+
+uint64_t Program::binaryKey(const std::vector<Shader>& shaders) {
+    uint64_t key = 14695981039346656037ull;
+    for (const GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION}) {
+        const char* value = reinterpret_cast<const char*>(glGetString(name));
+        key = fnv1a64(value, value ? std::strlen(value) + 1 : 0, key);
+    }
+    for (const Shader& shader : shaders) {
+        key = fnv1a64(&shader.type, sizeof(shader.type), key);
+        key = fnv1a64(shader.source.data(), shader.source.size() + 1, key);
+    }
+    return key;
+}
+
+void Program::link(const std::string& binaryCacheDirectory) {
+    m_binaryCacheDirectory = binaryCacheDirectory;
+    const uint64_t key = binaryCacheDirectory.empty() ? 0 : binaryKey(m_shaders);
+    if (binaryCacheDirectory.empty() || !loadProgramBinary(m_id, binaryCacheDirectory, key)) {
+        for (const Shader& shader : m_shaders)
+            compileShader(m_id, shader.type, shader.source, shader.label());
+        if (!binaryCacheDirectory.empty())
+            glProgramParameteri(m_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(m_id); // The GPU program is ready to be handle streams of polygons
+        check_linking(m_id);
+        GLint success = GL_FALSE;
+        glGetProgramiv(m_id, GL_LINK_STATUS, &success);
+        if (success && !binaryCacheDirectory.empty() && !saveProgramBinary(m_id, binaryCacheDirectory, key))
+            std::cout << "WARNING: Cannot write the program binary of " << m_shaders.front().filename << " in " << binaryCacheDirectory << std::endl;
+    }
+    cacheUniformLocations();
+}
+
+void Program::cacheUniformLocations() {
+    m_uniformLocations.clear();
+    GLint numUniforms = 0, maxNameLength = 0;
+    glGetProgramiv(m_id, GL_ACTIVE_UNIFORMS, &numUniforms);
+    glGetProgramiv(m_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+    std::vector<GLchar> name(maxNameLength + 1);
+    for (GLint u = 0; u < numUniforms; ++u) {
+        GLsizei length = 0;
+        glGetActiveUniformName(m_id, u, static_cast<GLsizei>(name.size()), &length, name.data());
+        const GLint loc = glGetUniformLocation(m_id, name.data());
+        if (loc < 0)
+            continue; // members of uniform blocks have no location
+        std::string uniformName(name.data(), length);
+        m_uniformLocations[uniformName] = loc;
+        const size_t bracket = uniformName.find("[0]");
+        if (bracket != std::string::npos)
+            m_uniformLocations[uniformName.substr(0, bracket)] = loc; // arrays are reachable by their bare name too
+    }
+}
+
+void Program::destroy() {
+    if (m_pendingId) {
+        for (GLuint shader : m_pendingShaders)
+            glDeleteShader(shader);
+        glDeleteProgram(m_pendingId);
+        m_pendingId = 0;
+        m_pendingShaders.clear();
+    }
+    glDeleteProgram(m_id);
+    m_id = 0;
+    m_shaders.clear();
+    m_uniformLocations.clear();
+    m_uniformBlockBindings.clear();
+}
+
+bool Program::uses(const std::string& filename) const {
+    for (const Shader& shader : m_shaders) {
+        if (std::find(shader.files.begin(), shader.files.end(), filename) != shader.files.end())
+            return true;
+    }
+    return false;
+}
+
+std::vector<std::string> Program::sourceFiles() const {
+    std::vector<std::string> filenames;
+    for (const Shader& shader : m_shaders) {
+        for (const std::string& file : shader.files) {
+            if (std::find(filenames.begin(), filenames.end(), file) == filenames.end())
+                filenames.push_back(file);
+        }
+    }
+    return filenames;
+}
+
+void Program::rebuild() {
+    if (m_pendingId) {
+        // sources changed again before the previous rebuild finished
+        for (GLuint shader : m_pendingShaders)
+            glDeleteShader(shader);
+        glDeleteProgram(m_pendingId);
+        m_pendingShaders.clear();
+    }
+    m_pendingSources = m_shaders;
+    for (Shader& shader : m_pendingSources)
+        shader.load(); // includes may have been added or removed
+
+    // no status query here: with parallel compilation all of this returns immediately
+    m_pendingId = glCreateProgram();
+    for (const Shader& shader : m_pendingSources) {
+        const GLuint id = glCreateShader(shader.type);
+        const GLchar* source = shader.source.c_str();
+        glShaderSource(id, 1, &source, NULL);
+        glCompileShader(id);
+        glAttachShader(m_pendingId, id);
+        m_pendingShaders.push_back(id);
+    }
+    if (!m_binaryCacheDirectory.empty())
+        glProgramParameteri(m_pendingId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(m_pendingId);
+}
+
+Program::RebuildStatus Program::pollRebuild() {
+    if (!m_pendingId)
+        return RebuildStatus::Idle;
+    if (GLAD_GL_KHR_parallel_shader_compile || GLAD_GL_ARB_parallel_shader_compile) {
+        GLint completed = GL_FALSE;
+        glGetProgramiv(m_pendingId, GL_COMPLETION_STATUS_KHR, &completed);
+        if (!completed)
+            return RebuildStatus::Pending;
+    }
+
+    bool success = true;
+    char infoLog[512];
+    for (size_t s = 0; s < m_pendingShaders.size(); ++s) {
+        GLint compiled = GL_FALSE;
+        glGetShaderiv(m_pendingShaders[s], GL_COMPILE_STATUS, &compiled);
+        if (!compiled) {
+            glGetShaderInfoLog(m_pendingShaders[s], 512, NULL, infoLog);
+            std::cout << "ERROR::" << m_pendingSources[s].label() << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+            success = false;
+        }
+        glDeleteShader(m_pendingShaders[s]); // flagged for deletion, freed with the program
+    }
+    m_pendingShaders.clear();
+    GLint linked = GL_FALSE;
+    glGetProgramiv(m_pendingId, GL_LINK_STATUS, &linked);
+    if (success && !linked) {
+        glGetProgramInfoLog(m_pendingId, 512, NULL, infoLog);
+        std::cout << "ERROR::" << "linking shaders" << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+    }
+    if (!success || !linked) {
+        glDeleteProgram(m_pendingId);
+        m_pendingId = 0;
+        return RebuildStatus::Failed;
+    }
+
+    glDeleteProgram(m_id); // in-flight draws keep it alive until they are done
+    m_id = m_pendingId;
+    m_pendingId = 0;
+    m_shaders.swap(m_pendingSources);
+    m_pendingSources.clear();
+    cacheUniformLocations();
+    applyUniformBlockBindings();
+    if (!m_binaryCacheDirectory.empty())
+        saveProgramBinary(m_id, m_binaryCacheDirectory, binaryKey(m_shaders));
+    return RebuildStatus::Swapped;
+}
+
+GLint Program::location(const std::string& name) const {
+    std::unordered_map<std::string, GLint>::const_iterator it = m_uniformLocations.find(name);
+    return it == m_uniformLocations.end() ? -1 : it->second;
+}
+
+void Program::bindUniformBlock(const std::string& blockName, const GLuint binding) {
+    m_uniformBlockBindings.push_back(std::make_pair(blockName, binding));
+    const GLuint blockIndex = glGetUniformBlockIndex(m_id, blockName.c_str());
+    if (blockIndex != GL_INVALID_INDEX)
+        glUniformBlockBinding(m_id, blockIndex, binding);
+}
+
+void Program::applyUniformBlockBindings() const {
+    for (const std::pair<std::string, GLuint>& block : m_uniformBlockBindings) {
+        const GLuint blockIndex = glGetUniformBlockIndex(m_id, block.first.c_str());
+        if (blockIndex != GL_INVALID_INDEX)
+            glUniformBlockBinding(m_id, blockIndex, block.second);
+    }
+}
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef _SCENE_
+#define _SCENE_
+
+// Flat scene graph of orbiting bodies, loaded from a text file. Nodes are
+// stored as a structure of arrays sorted in topological order (every parent
+// before its children), so update() computes all the transforms in one
+// linear pass over contiguous arrays, without recursion or lookups.
+//
+// The motion is simulated apart from the rendering: step() advances the
+// state of every body (its orbit and spin phases) by a fixed timestep and
+// keeps the state before the step, and update() computes the transforms
+// anywhere between these two states. The simulation rate is then free of
+// the frame rate, see FixedTimestep.
+//
+// The orbits are prescribed circles until enableGravity(): the bodies then
+// move under their mutual attraction, integrated by NBody, from the
+// positions and velocities they had on their orbits.
+//
+// Each body orbits its parent on a circle in the parent's XY plane, and
+// spins about its own axis. Children follow the orbit of their parent but
+// not its spin nor its size: world() is the orbit frame, model() adds the
+// spin and the scale of the body itself and is what gets drawn.
+//
+// Updates are incremental. Every node has a version counter bumped when its
+// world transform changes; children remember the version of their parent
+// they were computed from, so a change propagates down its subtree and
+// nowhere else. Per step and per frame, only the nodes moved by time
+// (orbiting or spinning, or below an orbiting node) are visited: static
+// subtrees cost nothing. Edits through the setters mark a node dirty, which costs one
+// pass over the whole scene on the next update().
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "nbody.h"
+
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Scene {
+public:
+    enum class Shading : uint8_t {
+        Lit,     // lit by the light at the origin
+        Emissive // light sources, drawn with their texture only
+    };
+
+    // One line per body, fields separated by spaces, '#' starts a comment:
+    //   name parent radius orbitRadius orbitPeriod spinPeriod tilt texture shading
+    // parent is '-' for the roots, periods are in seconds (0: no motion), the
+    // tilt of the spin axis is in degrees and shading is 'lit' or 'emissive'.
+    // Bodies may be listed in any order. Returns false on malformed files.
+    bool load(const std::string& filename);
+
+    // Advances the simulated state by dt seconds
+    void step(const double dt);
+    double time() const { return m_time; } // in seconds, of the latest state
+    // Transforms between the state before the latest step (alpha = 0) and
+    // the latest state (alpha = 1). Nothing is done if neither the state,
+    // alpha nor the scene changed since the previous call.
+    void update(const float alpha);
+
+    // Switches from the prescribed orbits to N-body gravity. Gravitational
+    // parameters follow from Kepler's third law, for the bodies that have
+    // satellites (through the orbit of the first one); the other bodies are
+    // massless. Every body starts on a circular orbit about its parent, and
+    // the center of mass is put at rest at the origin.
+    // setOrbit() has no effect afterwards. The forces are summed directly
+    // when theta is 0, through a Barnes-Hut tree of opening angle theta
+    // otherwise (for scenes of many bodies).
+    void enableGravity(const Integrator integrator, const float theta = 0.0f);
+    bool gravity() const { return m_gravity; }
+
+    // Edits, applied by the next update()
+    void setRadius(const size_t i, const float radius);
+    void setOrbit(const size_t i, const float orbitRadius, const float orbitPeriod);
+    void setSpin(const size_t i, const float spinPeriod, const float tiltDegrees);
+
+    // Work done by the last update()
+    struct UpdateStats {
+        size_t visited = 0;      // nodes whose inputs were checked
+        size_t worldUpdates = 0; // world transforms recomputed
+        size_t modelUpdates = 0; // model transforms recomputed
+    };
+    const UpdateStats& stats() const { return m_stats; }
+
+    size_t size() const { return m_parent.size(); }
+    int find(const std::string& name) const; // -1 when there is no such body
+
+    const std::string& name(const size_t i) const { return m_name[i]; }
+    int parent(const size_t i) const { return m_parent[i]; }
+    Shading shading(const size_t i) const { return m_shading[i]; }
+    uint32_t texture(const size_t i) const { return m_texture[i]; } // index in textures()
+    const std::vector<std::string>& textures() const { return m_textures; } // each file once, in order of first use
+
+    const glm::mat4& world(const size_t i) const { return m_world[i]; }
+    const glm::mat4& model(const size_t i) const { return m_model[i]; }
+    glm::vec3 position(const size_t i) const { return glm::vec3(m_world[i][3]); }
+
+private:
+    void clear();
+    enum DirtyFlags : uint8_t {
+        kDirtyOrbit = 1, // local, world and model transforms, and those of the subtree
+        kDirtyBody = 2   // model transform only: the children do not follow the spin nor the size
+    };
+    void markDirty(const size_t i, const uint8_t flags);
+    void computePhases(const size_t i); // at m_time
+    void restartPhases(const size_t i); // after an edit, without interpolating from the previous motion
+    void updateNode(const size_t i, const bool stateChanged, const float alpha);
+    void buildTimeDrivenList();
+
+    // one entry per body, in topological order
+    std::vector<std::string> m_name; // only looked up on user input
+    std::vector<int32_t> m_parent;   // -1 for roots, always smaller than the index of the child
+    std::vector<float> m_radius;
+    std::vector<float> m_orbitRadius;
+    std::vector<float> m_orbitPeriod;
+    std::vector<float> m_spinPeriod;
+    std::vector<glm::vec3> m_spinAxis;
+    std::vector<uint32_t> m_texture;
+    std::vector<Shading> m_shading;
+    std::vector<double> m_orbitPhase; // simulated state, in radians
+    std::vector<double> m_spinPhase;
+    std::vector<double> m_previousOrbitPhase; // state before the latest step
+    std::vector<double> m_previousSpinPhase;
+    std::vector<glm::vec3> m_position; // simulated state with gravity, in world space
+    std::vector<glm::vec3> m_previousPosition;
+    std::vector<glm::mat4> m_local; // orbit position in the parent orbit frame
+    std::vector<glm::mat4> m_world;
+    std::vector<glm::mat4> m_model;
+    std::vector<uint32_t> m_version;       // bumped when the world transform changes
+    std::vector<uint32_t> m_parentVersion; // version of the parent the world transform was computed from
+    std::vector<uint8_t> m_dirty;          // DirtyFlags, edited since the last update
+
+    bool m_gravity = false;
+    NBody m_nbody; // positions and velocities of the bodies, with gravity
+
+    std::vector<uint32_t> m_timeDriven; // nodes moved by time, in topological order
+    bool m_timeDrivenStale = true;
+    size_t m_numDirty = 0;
+    double m_time = 0.0;
+    uint64_t m_steps = 0;
+    uint64_t m_updatedSteps = 0; // state and alpha of the latest update()
+    float m_updatedAlpha = std::numeric_limits<float>::quiet_NaN();
+    UpdateStats m_stats;
+
+    std::vector<std::string> m_textures;
+    std::unordered_map<std::string, int> m_index; // name to index
+};
+
+void Scene::clear() {
+    m_name.clear();
+    m_parent.clear();
+    m_radius.clear();
+    m_orbitRadius.clear();
+    m_orbitPeriod.clear();
+    m_spinPeriod.clear();
+    m_spinAxis.clear();
+    m_texture.clear();
+    m_shading.clear();
+    m_local.clear();
+    m_world.clear();
+    m_model.clear();
+    m_orbitPhase.clear();
+    m_spinPhase.clear();
+    m_previousOrbitPhase.clear();
+    m_previousSpinPhase.clear();
+    m_position.clear();
+    m_previousPosition.clear();
+    m_gravity = false;
+    m_nbody.clear();
+    m_version.clear();
+    m_parentVersion.clear();
+    m_dirty.clear();
+    m_timeDriven.clear();
+    m_timeDrivenStale = true;
+    m_numDirty = 0;
+    m_time = 0.0;
+    m_steps = 0;
+    m_updatedSteps = 0;
+    m_updatedAlpha = std::numeric_limits<float>::quiet_NaN();
+    m_textures.clear();
+    m_index.clear();
+}
+
+bool Scene::load(const std::string& filename) {
+    std::ifstream file(filename.c_str());
+    if (!file) {
+        std::cout << "ERROR: Cannot load " << filename << std::endl;
+        return false;
+    }
+
+    // parsed in file order first
+    struct Body {
+        std::string name, parent, texture, shading;
+        float radius, orbitRadius, orbitPeriod, spinPeriod, tilt;
+        int line;
+    };
+    std::vector<Body> bodies;
+    std::unordered_map<std::string, size_t> byName;
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number) {
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos)
+            line.erase(comment);
+        std::istringstream fields(line);
+        Body body;
+        body.line = number;
+        if (!(fields >> body.name))
+            continue; // blank line
+        if (!(fields >> body.parent >> body.radius >> body.orbitRadius >> body.orbitPeriod >> body.spinPeriod >> body.tilt >> body.texture >> body.shading)
+            || (body.shading != "lit" && body.shading != "emissive")) {
+            std::cout << "ERROR: " << filename << ":" << number << ": expected 'name parent radius orbitRadius orbitPeriod spinPeriod tilt texture lit|emissive'" << std::endl;
+            return false;
+        }
+        if (!byName.insert(std::make_pair(body.name, bodies.size())).second) {
+            std::cout << "ERROR: " << filename << ":" << number << ": body " << body.name << " is defined twice" << std::endl;
+            return false;
+        }
+        bodies.push_back(body);
+    }
+
+    // depth of every body; sorting by depth puts parents before children
+    std::vector<int> depth(bodies.size(), -1);
+    for (size_t b = 0; b < bodies.size(); ++b) {
+        std::vector<size_t> chain; // b and its ancestors whose depth is unknown yet
+        size_t current = b;
+        int base = 0;
+        while (depth[current] < 0) {
+            if (std::find(chain.begin(), chain.end(), current) != chain.end()) {
+                std::cout << "ERROR: " << filename << ":" << bodies[current].line << ": body " << bodies[current].name << " is its own ancestor" << std::endl;
+                return false;
+            }
+            chain.push_back(current);
+            if (bodies[current].parent == "-")
+                break;
+            const std::unordered_map<std::string, size_t>::const_iterator parent = byName.find(bodies[current].parent);
+            if (parent == byName.end()) {
+                std::cout << "ERROR: " << filename << ":" << bodies[current].line << ": unknown parent " << bodies[current].parent << std::endl;
+                return false;
+            }
+            current = parent->second;
+        }
+        if (depth[current] >= 0)
+            base = depth[current] + 1;
+        for (std::vector<size_t>::reverse_iterator it = chain.rbegin(); it != chain.rend(); ++it)
+            depth[*it] = base++;
+    }
+    std::vector<size_t> order(bodies.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&depth](const size_t a, const size_t b) { return depth[a] < depth[b]; });
+
+    clear();
+    for (const size_t b : order) {
+        const Body& body = bodies[b];
+        m_index[body.name] = static_cast<int>(m_name.size());
+        m_name.push_back(body.name);
+        m_parent.push_back(body.parent == "-" ? -1 : m_index[body.parent]);
+        m_radius.push_back(body.radius);
+        m_orbitRadius.push_back(body.orbitRadius);
+        m_orbitPeriod.push_back(body.orbitPeriod);
+        m_spinPeriod.push_back(body.spinPeriod);
+        const float tilt = glm::radians(body.tilt);
+        m_spinAxis.push_back(glm::vec3(std::sin(tilt), 0.0f, std::cos(tilt)));
+        std::vector<std::string>::iterator texture = std::find(m_textures.begin(), m_textures.end(), body.texture);
+        m_texture.push_back(static_cast<uint32_t>(texture - m_textures.begin()));
+        if (texture == m_textures.end())
+            m_textures.push_back(body.texture);
+        m_shading.push_back(body.shading == "lit" ? Shading::Lit : Shading::Emissive);
+    }
+    m_local.assign(size(), glm::mat4(1.0f));
+    m_world.assign(size(), glm::mat4(1.0f));
+    m_model.assign(size(), glm::mat4(1.0f));
+    m_orbitPhase.assign(size(), 0.0);
+    m_spinPhase.assign(size(), 0.0);
+    m_previousOrbitPhase.assign(size(), 0.0);
+    m_previousSpinPhase.assign(size(), 0.0);
+    m_version.assign(size(), 0);
+    m_parentVersion.assign(size(), 0);
+    m_dirty.assign(size(), kDirtyOrbit | kDirtyBody);
+    m_numDirty = size();
+    update(0.0f);
+    return true;
+}
+
+int Scene::find(const std::string& name) const {
+    const std::unordered_map<std::string, int>::const_iterator it = m_index.find(name);
+    return it == m_index.end() ? -1 : it->second;
+}
+
+void Scene::markDirty(const size_t i, const uint8_t flags) {
+    if (!m_dirty[i])
+        ++m_numDirty;
+    m_dirty[i] |= flags;
+}
+
+void Scene::setRadius(const size_t i, const float radius) {
+    m_radius[i] = radius;
+    markDirty(i, kDirtyBody);
+}
+
+void Scene::setOrbit(const size_t i, const float orbitRadius, const float orbitPeriod) {
+    m_orbitRadius[i] = orbitRadius;
+    m_orbitPeriod[i] = orbitPeriod;
+    restartPhases(i);
+    m_timeDrivenStale = true;
+    markDirty(i, kDirtyOrbit | kDirtyBody); // a tidally locked spin uses the orbit phase
+}
+
+void Scene::setSpin(const size_t i, const float spinPeriod, const float tiltDegrees) {
+    m_spinPeriod[i] = spinPeriod;
+    const float tilt = glm::radians(tiltDegrees);
+    m_spinAxis[i] = glm::vec3(std::sin(tilt), 0.0f, std::cos(tilt));
+    restartPhases(i);
+    m_timeDrivenStale = true;
+    markDirty(i, kDirtyBody);
+}
+
+// Nodes that orbit or spin, and every node below an orbiting one
+void Scene::buildTimeDrivenList() {
+    m_timeDriven.clear();
+    std::vector<uint8_t> moving(size(), 0); // world transform changes with time
+    for (size_t i = 0; i < size(); ++i) {
+        const bool orbits = m_orbitPeriod[i] != 0.0f && m_orbitRadius[i] != 0.0f;
+        moving[i] = m_gravity || orbits || (m_parent[i] >= 0 && moving[m_parent[i]]);
+        if (moving[i] || m_spinPeriod[i] != 0.0f)
+            m_timeDriven.push_back(static_cast<uint32_t>(i));
+    }
+    m_timeDrivenStale = false;
+}
+
+void Scene::computePhases(const size_t i) {
+    const bool orbits = m_orbitPeriod[i] != 0.0f && m_orbitRadius[i] != 0.0f;
+    m_orbitPhase[i] = orbits ? 2.0 * M_PI * m_time / m_orbitPeriod[i] : 0.0;
+    if (m_spinPeriod[i] == 0.0f)
+        m_spinPhase[i] = 0.0;
+    else if (orbits && m_spinPeriod[i] == m_orbitPeriod[i])
+        m_spinPhase[i] = m_orbitPhase[i]; // tidally locked: one phase for both
+    else
+        m_spinPhase[i] = 2.0 * M_PI * m_time / m_spinPeriod[i];
+}
+
+void Scene::restartPhases(const size_t i) {
+    computePhases(i);
+    m_previousOrbitPhase[i] = m_orbitPhase[i];
+    m_previousSpinPhase[i] = m_spinPhase[i];
+}
+
+void Scene::step(const double dt) {
+    if (m_timeDrivenStale)
+        buildTimeDrivenList();
+    m_time += dt;
+    ++m_steps;
+    if (m_gravity) {
+        m_previousPosition.swap(m_position);
+        m_nbody.step(dt);
+        for (size_t i = 0; i < size(); ++i)
+            m_position[i] = m_nbody.position(i);
+    }
+    for (const uint32_t i : m_timeDriven) {
+        m_previousOrbitPhase[i] = m_orbitPhase[i];
+        m_previousSpinPhase[i] = m_spinPhase[i];
+        computePhases(i);
+    }
+}
+
+void Scene::enableGravity(const Integrator integrator, const float theta) {
+    update(1.0f); // positions of the latest state
+    std::vector<float> mu(size(), 0.0f);
+    for (size_t i = 0; i < size(); ++i) {
+        const int parent = m_parent[i];
+        if (parent >= 0 && mu[parent] == 0.0f && m_orbitPeriod[i] != 0.0f && m_orbitRadius[i] != 0.0f) {
+            const float omega = static_cast<float>(2.0 * M_PI / m_orbitPeriod[i]);
+            mu[parent] = omega * omega * m_orbitRadius[i] * m_orbitRadius[i] * m_orbitRadius[i]; // Kepler: mu = omega^2 r^3
+        }
+    }
+    // circular orbits about the parent, at the speed for the two bodies
+    std::vector<glm::vec3> velocity(size(), glm::vec3(0.0f));
+    for (size_t i = 0; i < size(); ++i) {
+        const int parent = m_parent[i];
+        if (parent < 0)
+            continue;
+        velocity[i] = velocity[parent];
+        if (m_orbitPeriod[i] == 0.0f || m_orbitRadius[i] == 0.0f)
+            continue;
+        const float speed = std::sqrt((mu[parent] + mu[i]) / m_orbitRadius[i]);
+        const float phase = static_cast<float>(m_orbitPhase[i]);
+        velocity[i] += (m_orbitPeriod[i] > 0.0f ? speed : -speed) * glm::vec3(-std::sin(phase), std::cos(phase), 0.0f);
+    }
+    // center of mass at rest at the origin, where the light is
+    glm::vec3 center(0.0f), momentum(0.0f);
+    float totalMu = 0.0f;
+    for (size_t i = 0; i < size(); ++i) {
+        center += mu[i] * position(i);
+        momentum += mu[i] * velocity[i];
+        totalMu += mu[i];
+    }
+    if (totalMu > 0.0f) {
+        center /= totalMu;
+        momentum /= totalMu;
+    }
+    m_nbody.clear();
+    m_nbody.setIntegrator(integrator);
+    m_nbody.setSolver(theta > 0.0f ? ForceSolver::BarnesHut : ForceSolver::Direct, theta);
+    m_position.resize(size());
+    for (size_t i = 0; i < size(); ++i) {
+        m_position[i] = position(i) - center;
+        m_nbody.add(m_position[i], velocity[i] - momentum, mu[i]);
+    }
+    m_previousPosition = m_position;
+    m_gravity = true;
+    m_timeDrivenStale = true;
+    for (size_t i = 0; i < size(); ++i)
+        markDirty(i, kDirtyOrbit);
+}
+
+void Scene::updateNode(const size_t i, const bool stateChanged, const float alpha) {
+    ++m_stats.visited;
+    const uint8_t dirty = m_dirty[i];
+    m_dirty[i] = 0;
+
+    bool worldChanged = false;
+    if (m_gravity) {
+        // positions are in world space: the parent does not matter
+        worldChanged = (dirty & kDirtyOrbit) || stateChanged;
+        if (worldChanged)
+            m_world[i] = glm::translate(glm::mat4(1.0f), glm::mix(m_previousPosition[i], m_position[i], alpha));
+    } else {
+        const bool orbits = m_orbitPeriod[i] != 0.0f && m_orbitRadius[i] != 0.0f;
+        const bool localChanged = (dirty & kDirtyOrbit) || (stateChanged && orbits);
+        if (localChanged) {
+            const float orbitPhase = static_cast<float>(m_previousOrbitPhase[i] + alpha * (m_orbitPhase[i] - m_previousOrbitPhase[i]));
+            m_local[i] = glm::translate(glm::mat4(1.0f), m_orbitRadius[i] * glm::vec3(std::cos(orbitPhase), std::sin(orbitPhase), 0.0f));
+        }
+
+        const int parent = m_parent[i];
+        const uint32_t parentVersion = parent < 0 ? 0 : m_version[parent];
+        worldChanged = localChanged || parentVersion != m_parentVersion[i];
+        if (worldChanged) {
+            m_world[i] = parent < 0 ? m_local[i] : m_world[parent] * m_local[i]; // the parent is already up to date
+            m_parentVersion[i] = parentVersion;
+        }
+    }
+    if (worldChanged) {
+        ++m_version[i];
+        ++m_stats.worldUpdates;
+    }
+
+    const bool spins = m_spinPeriod[i] != 0.0f;
+    if (worldChanged || (dirty & kDirtyBody) || (stateChanged && spins)) {
+        glm::mat4 model = m_world[i];
+        if (spins) {
+            const float spinPhase = static_cast<float>(m_previousSpinPhase[i] + alpha * (m_spinPhase[i] - m_previousSpinPhase[i]));
+            model = glm::rotate(model, spinPhase, m_spinAxis[i]);
+        }
+        m_model[i] = glm::scale(model, glm::vec3(m_radius[i]));
+        ++m_stats.modelUpdates;
+    }
+}
+
+void Scene::update(const float alpha) {
+    const bool stateChanged = m_steps != m_updatedSteps || alpha != m_updatedAlpha;
+    m_updatedSteps = m_steps;
+    m_updatedAlpha = alpha;
+    m_stats = UpdateStats();
+    if (m_numDirty > 0) {
+        // edits may have started or stopped motions anywhere: one full pass
+        if (m_timeDrivenStale)
+            buildTimeDrivenList();
+        for (size_t i = 0; i < size(); ++i)
+            updateNode(i, stateChanged, alpha);
+        m_numDirty = 0;
+    } else if (stateChanged) {
+        for (const uint32_t i : m_timeDriven)
+            updateNode(i, true, alpha);
+    }
+}
+
+#endif
@@ -0,0 +1,1139 @@
+#ifndef _TEXTURE_
+#define _TEXTURE_
+
+#include <glad/glad.h>
+
+#include "stb_image.h"
+#include "dds.h"
+#include "file_utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_SSE2
+#include <emmintrin.h>
+#endif
+
+// Decoded image in CPU memory, tightly packed rows
+struct Image {
+    int width = 0;
+    int height = 0;
+    int channels = 0; // 1 for a 8 bit greyscale image, 3 for 24bits RGB image, 4 for 32bits RGBA image
+    std::shared_ptr<unsigned char> pixels;
+
+    bool valid() const { return pixels != nullptr; }
+    size_t byteSize() const { return static_cast<size_t>(width) * height * channels; }
+};
+
+// Loading the image in CPU memory using stb_image; safe to call from any thread.
+// With desiredChannels, stb_image converts the texels to that many channels.
+Image decodeImage(const std::string& filename, const int desiredChannels = 0) {
+    Image image;
+    unsigned char* data = stbi_load(filename.c_str(), &image.width, &image.height, &image.channels, desiredChannels);
+    if (!data) {
+        std::cout << "ERROR: Cannot load " << filename << ": " << stbi_failure_reason() << std::endl;
+        return image;
+    }
+    if (desiredChannels)
+        image.channels = desiredChannels;
+    image.pixels = std::shared_ptr<unsigned char>(data, stbi_image_free);
+    return image;
+}
+
+// Where the mip chain of a texture comes from
+enum class MipGeneration {
+    None, // level 0 only
+    Cpu,  // box filtered on the loader threads, see generateMipChain()
+    Gpu   // glGenerateTextureMipmap after the upload of level 0
+};
+
+// Sampling state applied to every texture created here
+struct TextureSampling {
+    MipGeneration mips = MipGeneration::Cpu;
+    bool trilinear = true;      // blend between mip levels, otherwise pick the nearest one
+    float maxAnisotropy = 8.f;  // 1 disables anisotropic filtering; clamped to what the driver supports
+};
+
+#ifdef TEXTURE_SSE2
+// 4 RGBA output texels per iteration from two source rows, with the exact
+// rounding of the scalar loop: 16 bit vertical sums, then the two texels of
+// each pair added across the register halves. Returns the texels done.
+int downsampleRowRGBASse2(const unsigned char* row0, const unsigned char* row1, unsigned char* out, const int width) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    auto pairSums = [&](const __m128i a, const __m128i b, __m128i& first, __m128i& second) {
+        const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); // texels 0 and 1
+        const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)); // texels 2 and 3
+        first = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        second = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    };
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i s0, s1, s2, s3;
+        pairSums(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x)), s0, s1);
+        pairSums(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + 8 * x + 16)), _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + 8 * x + 16)), s2, s3);
+        const __m128i texels01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s0, s1), two), 2);
+        const __m128i texels23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(s2, s3), two), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * x), _mm_packus_epi16(texels01, texels23));
+    }
+    return x;
+}
+#endif
+
+// Next level of a mip chain: each texel is the rounded average of a 2x2
+// footprint, clamped at the border so that odd and 1-texel sizes still work.
+// RGBA rows, what the texture array gets, go through SSE2 when the target has
+// it; other channel counts and the row tails take the scalar loop.
+Image downsampleBox(const Image& src) {
+    Image dst;
+    dst.width = std::max(1, src.width / 2);
+    dst.height = std::max(1, src.height / 2);
+    dst.channels = src.channels;
+    dst.pixels = std::shared_ptr<unsigned char>(new unsigned char[dst.byteSize()], std::default_delete<unsigned char[]>());
+
+    const int c = src.channels;
+    const size_t srcStride = static_cast<size_t>(src.width) * c;
+    const size_t dstStride = static_cast<size_t>(dst.width) * c;
+    for (int y = 0; y < dst.height; ++y) {
+        const unsigned char* row0 = src.pixels.get() + std::min(2 * y, src.height - 1) * srcStride;
+        const unsigned char* row1 = src.pixels.get() + std::min(2 * y + 1, src.height - 1) * srcStride;
+        unsigned char* out = dst.pixels.get() + y * dstStride;
+        if (src.width == 1) {
+            for (int k = 0; k < c; ++k)
+                out[k] = static_cast<unsigned char>((2 * row0[k] + 2 * row1[k] + 2) >> 2);
+            continue;
+        }
+        int x = 0;
+#ifdef TEXTURE_SSE2
+        if (c == 4)
+            x = downsampleRowRGBASse2(row0, row1, out, dst.width);
+#endif
+        for (; x < dst.width; ++x) {
+            const unsigned char* a = row0 + 2 * x * c;
+            const unsigned char* b = row1 + 2 * x * c;
+            for (int k = 0; k < c; ++k) {
+                const unsigned int sum = a[k] + a[k + c] + b[k] + b[k + c];
+                out[x * c + k] = static_cast<unsigned char>((sum + 2) >> 2);
+            }
+        }
+    }
+    return dst;
+}
+
+// Bilinear resampling to an arbitrary size, texel centers aligned; used to
+// bring images of different sizes to the common size of a texture array
+Image resizeImage(const Image& src, const int width, const int height) {
+    if (src.width == width && src.height == height)
+        return src;
+    Image dst;
+    dst.width = width;
+    dst.height = height;
+    dst.channels = src.channels;
+    dst.pixels = std::shared_ptr<unsigned char>(new unsigned char[dst.byteSize()], std::default_delete<unsigned char[]>());
+    const int c = src.channels;
+    for (int y = 0; y < height; ++y) {
+        const float sy = std::min(std::max((y + 0.5f) * src.height / height - 0.5f, 0.f), src.height - 1.f);
+        const int y0 = static_cast<int>(sy), y1 = std::min(y0 + 1, src.height - 1);
+        const float fy = sy - y0;
+        for (int x = 0; x < width; ++x) {
+            const float sx = std::min(std::max((x + 0.5f) * src.width / width - 0.5f, 0.f), src.width - 1.f);
+            const int x0 = static_cast<int>(sx), x1 = std::min(x0 + 1, src.width - 1);
+            const float fx = sx - x0;
+            for (int k = 0; k < c; ++k) {
+                auto at = [&](int xx, int yy) { return static_cast<float>(src.pixels.get()[(static_cast<size_t>(yy) * src.width + xx) * c + k]); };
+                const float top = at(x0, y0) + (at(x1, y0) - at(x0, y0)) * fx;
+                const float bottom = at(x0, y1) + (at(x1, y1) - at(x0, y1)) * fx;
+                dst.pixels.get()[(static_cast<size_t>(y) * width + x) * c + k] = static_cast<unsigned char>(top + (bottom - top) * fy + 0.5f);
+            }
+        }
+    }
+    return dst;
+}
+
+// Whole chain, level 0 first, down to 1x1
+std::vector<Image> generateMipChain(const Image& base) {
+    std::vector<Image> levels(1, base);
+    while (levels.back().width > 1 || levels.back().height > 1)
+        levels.push_back(downsampleBox(levels.back()));
+    return levels;
+}
+
+// Compares every level of generateMipChain() against a reference computed
+// directly from level 0: the rounded mean of the whole footprint of the texel.
+// Level 1 is that rounded mean exactly; after it, repeated 2x2 rounding can
+// drift by at most half a unit per level, hence the tolerance of
+// (level + 1) / 2. Only power of two images have an exact footprint. Prints
+// one row per level and returns false on any mismatch.
+bool checkMipChain(const std::string& name, const Image& base) {
+    const std::vector<Image> levels = generateMipChain(base);
+    bool passed = levels.size() == static_cast<size_t>(mipLevelCount(base.width, base.height));
+    const int c = base.channels;
+    for (size_t l = 1; l < levels.size(); ++l) {
+        const Image& level = levels[l];
+        const int footprintW = base.width / level.width;
+        const int footprintH = base.height / level.height;
+        int maxError = 0;
+        double sumError = 0.0;
+        for (int y = 0; y < level.height; ++y) {
+            for (int x = 0; x < level.width; ++x) {
+                for (int k = 0; k < c; ++k) {
+                    double sum = 0.0;
+                    for (int fy = 0; fy < footprintH; ++fy)
+                        for (int fx = 0; fx < footprintW; ++fx)
+                            sum += base.pixels.get()[(static_cast<size_t>(y * footprintH + fy) * base.width + x * footprintW + fx) * c + k];
+                    const int reference = static_cast<int>(std::floor(sum / (footprintW * footprintH) + 0.5));
+                    const int error = std::abs(level.pixels.get()[(static_cast<size_t>(y) * level.width + x) * c + k] - reference);
+                    maxError = std::max(maxError, error);
+                    sumError += error;
+                }
+            }
+        }
+        const int tolerance = l == 1 ? 0 : static_cast<int>(l + 1) / 2;
+        passed = passed && maxError <= tolerance;
+        std::cout << std::left << std::setw(28) << name << std::setw(8) << l << std::setw(12)
+                  << (std::to_string(level.width) + "x" + std::to_string(level.height)) << std::setw(12) << maxError
+                  << std::setw(14) << sumError / level.byteSize() << (maxError <= tolerance ? "ok" : "FAILED") << std::endl;
+    }
+    return passed;
+}
+
+// Runs checkMipChain() on synthetic images (noise, odd aspect ratios, single
+// row) and on the given files
+bool printMipChainCheck(const std::vector<std::string>& filenames) {
+    std::cout << std::left << std::setw(28) << "image" << std::setw(8) << "level" << std::setw(12) << "size"
+              << std::setw(12) << "max error" << std::setw(14) << "mean error" << "result" << std::endl;
+    std::mt19937 random(42);
+    auto synthetic = [&random](const int width, const int height, const int channels) {
+        Image image;
+        image.width = width;
+        image.height = height;
+        image.channels = channels;
+        image.pixels = std::shared_ptr<unsigned char>(new unsigned char[image.byteSize()], std::default_delete<unsigned char[]>());
+        for (size_t i = 0; i < image.byteSize(); ++i)
+            image.pixels.get()[i] = static_cast<unsigned char>(random() & 0xFF);
+        return image;
+    };
+    bool passed = true;
+    passed = checkMipChain("noise 256x256 rgb", synthetic(256, 256, 3)) && passed;
+    passed = checkMipChain("noise 128x16 rgba", synthetic(128, 16, 4)) && passed;
+    passed = checkMipChain("noise 512x256 rgba", synthetic(512, 256, 4)) && passed; // mostly the SSE2 rows
+    passed = checkMipChain("noise 4x64 grey", synthetic(4, 64, 1)) && passed;
+    passed = checkMipChain("noise 32x1 rg", synthetic(32, 1, 2)) && passed;
+    for (const std::string& filename : filenames) {
+        for (const int channels : {0, 4}) { // native, and RGBA as loaded into the texture array
+            const Image image = decodeImage(filename, channels);
+            if (image.valid())
+                passed = checkMipChain(filename + (channels ? " rgba" : ""), image) && passed;
+            else
+                passed = false;
+        }
+    }
+    std::cout << (passed ? "All mip chains match the reference" : "Some mip chains do not match the reference") << std::endl;
+    return passed;
+}
+
+// Matching formats for 1 to 4 channels
+GLenum textureInternalFormat(const int channels) {
+    const GLenum formats[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+    return formats[channels - 1];
+}
+GLenum texturePixelFormat(const int channels) {
+    const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+    return formats[channels - 1];
+}
+
+void applySampling(const GLuint texID, const int numLevels, const TextureSampling& sampling) {
+    // The following lines setup the texture filtering option and repeat mode; check www.opengl.org for details.
+    glTextureParameteri(texID, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    GLenum minFilter = GL_LINEAR;
+    if (numLevels > 1)
+        minFilter = sampling.trilinear ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR_MIPMAP_NEAREST;
+    glTextureParameteri(texID, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTextureParameteri(texID, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(texID, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTextureParameteri(texID, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    if (sampling.maxAnisotropy > 1.f && GLAD_GL_EXT_texture_filter_anisotropic) {
+        GLfloat supported = 1.f;
+        glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &supported);
+        glTextureParameterf(texID, GL_TEXTURE_MAX_ANISOTROPY_EXT, std::min(sampling.maxAnisotropy, supported));
+    }
+}
+
+// Ring of persistently mapped pixel unpack buffers. Every upload copies its
+// texels into the next buffer of the ring and the transfers reading it are
+// fenced, so a buffer is written again only once the GPU is done with it and
+// the driver never allocates storage for a transfer (a buffer is only
+// recreated when an upload outgrows it).
+class PixelUploadRing {
+public:
+    void init(const size_t numBuffers = 3);
+    // Mapping of the next buffer, at least size bytes, bound to GL_PIXEL_UNPACK_BUFFER;
+    // waits when the GPU has not consumed the previous transfer from it yet
+    unsigned char* begin(const size_t size);
+    void end(); // fences the transfers issued since begin() and unbinds the buffer
+    void destroy();
+
+private:
+    struct Buffer {
+        GLuint id = 0;
+        size_t capacity = 0;
+        unsigned char* mapping = nullptr;
+        GLsync fence = nullptr;
+    };
+    static void waitFor(Buffer& buffer);
+
+    std::vector<Buffer> m_buffers;
+    size_t m_next = 0;
+};
+
+void PixelUploadRing::init(const size_t numBuffers) {
+    m_buffers.resize(numBuffers);
+    m_next = 0;
+}
+
+void PixelUploadRing::waitFor(Buffer& buffer) {
+    if (!buffer.fence)
+        return;
+    while (glClientWaitSync(buffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(buffer.fence);
+    buffer.fence = nullptr;
+}
+
+unsigned char* PixelUploadRing::begin(const size_t size) {
+    Buffer& buffer = m_buffers[m_next];
+    waitFor(buffer);
+    if (buffer.capacity < size) {
+        if (buffer.id) {
+            glUnmapNamedBuffer(buffer.id);
+            glDeleteBuffers(1, &buffer.id);
+        }
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glCreateBuffers(1, &buffer.id);
+        glNamedBufferStorage(buffer.id, size, NULL, flags);
+        buffer.mapping = static_cast<unsigned char*>(glMapNamedBufferRange(buffer.id, 0, size, flags));
+        buffer.capacity = size;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.id);
+    return buffer.mapping;
+}
+
+void PixelUploadRing::end() {
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_buffers[m_next].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    m_next = (m_next + 1) % m_buffers.size();
+}
+
+void PixelUploadRing::destroy() {
+    for (Buffer& buffer : m_buffers) {
+        waitFor(buffer);
+        if (buffer.id) {
+            glUnmapNamedBuffer(buffer.id);
+            glDeleteBuffers(1, &buffer.id);
+        }
+    }
+    m_buffers.clear();
+}
+
+// Uploads a mip chain, level 0 first, into a 2D texture (layer < 0) or into
+// one layer of a 2D array texture. With a ring, all levels are first copied
+// into one of its pixel buffers so that the driver can schedule the transfer
+// instead of copying them synchronously.
+void uploadImageLevels(const GLuint texID, const std::vector<Image>& levels, const GLint layer, PixelUploadRing* ring) {
+    const GLenum format = texturePixelFormat(levels.front().channels);
+    auto uploadLevel = [&](const size_t l, const void* pixels) {
+        if (layer < 0)
+            glTextureSubImage2D(texID, static_cast<GLint>(l), 0, 0, levels[l].width, levels[l].height, format, GL_UNSIGNED_BYTE, pixels);
+        else
+            glTextureSubImage3D(texID, static_cast<GLint>(l), 0, 0, layer, levels[l].width, levels[l].height, 1, format, GL_UNSIGNED_BYTE, pixels);
+    };
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB rows are not necessarily a multiple of 4 bytes
+    if (ring) {
+        size_t totalSize = 0;
+        for (const Image& level : levels)
+            totalSize += level.byteSize();
+        unsigned char* staging = ring->begin(totalSize);
+        size_t offset = 0;
+        for (const Image& level : levels) {
+            std::memcpy(staging + offset, level.pixels.get(), level.byteSize());
+            offset += level.byteSize();
+        }
+        offset = 0;
+        for (size_t l = 0; l < levels.size(); ++l) {
+            uploadLevel(l, reinterpret_cast<const void*>(offset));
+            offset += levels[l].byteSize();
+        }
+        ring->end();
+    } else {
+        // fills the GPU texture with the data stored in the CPU images
+        for (size_t l = 0; l < levels.size(); ++l)
+            uploadLevel(l, levels[l].pixels.get());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Creates an immutable texture from a mip chain (a single level for
+// MipGeneration::None and Gpu)
+GLuint createTextureFromImages(const std::vector<Image>& levels, const TextureSampling& sampling, PixelUploadRing* ring) {
+    const Image& base = levels.front();
+    const bool gpuMips = sampling.mips == MipGeneration::Gpu && levels.size() == 1;
+    const int numLevels = gpuMips ? mipLevelCount(base.width, base.height) : static_cast<int>(levels.size());
+
+    GLuint texID; // OpenGL texture identifier
+    glCreateTextures(GL_TEXTURE_2D, 1, &texID);
+    applySampling(texID, numLevels, sampling);
+    glTextureStorage2D(texID, numLevels, textureInternalFormat(base.channels), base.width, base.height);
+    uploadImageLevels(texID, levels, -1, ring);
+    if (gpuMips)
+        glGenerateTextureMipmap(texID);
+    return texID;
+}
+
+
+
+// ---- Colour conversion ----
+// Channel expansion and transfer function changes, done in one pass after
+// decoding. stb_image already runs its JPEG IDCT, chroma upsampling and
+// YCbCr conversion with SSE2 on x86/x64 (STBI_SSE2, see stb_image.h) and
+// decodes fastest at the native channel count; the RGB to RGBA expansion that
+// lets the driver take its 4 byte per texel fast path uses SSSE3 when the CPU
+// has it. Transfer functions go through 256 entry tables: a SIMD gather is
+// not faster than scalar lookups at 8 bits per channel.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TEXTURE_X86_SIMD
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TEXTURE_TARGET_SSSE3
+#else
+#include <cpuid.h>
+#define TEXTURE_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+enum class ColorTransfer {
+    None,
+    SrgbToLinear, // e.g. for maps that are not colors, stored sRGB by image editors
+    LinearToSrgb
+};
+
+const unsigned char* transferTable(const ColorTransfer transfer) {
+    struct Tables {
+        unsigned char toLinear[256];
+        unsigned char toSrgb[256];
+        Tables() {
+            for (int i = 0; i < 256; ++i) {
+                const double c = i / 255.0;
+                const double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+                const double srgb = c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055;
+                toLinear[i] = static_cast<unsigned char>(linear * 255.0 + 0.5);
+                toSrgb[i] = static_cast<unsigned char>(srgb * 255.0 + 0.5);
+            }
+        }
+    };
+    static const Tables tables; // thread-safe initialization
+    return transfer == ColorTransfer::SrgbToLinear ? tables.toLinear : tables.toSrgb;
+}
+
+// Reference path: any channel count to 3 or 4 (grey is replicated, missing alpha is opaque)
+void convertPixelsScalar(const unsigned char* src, const int srcChannels, unsigned char* dst, const int dstChannels, const size_t count, const ColorTransfer transfer) {
+    const unsigned char* table = transfer == ColorTransfer::None ? nullptr : transferTable(transfer);
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char* in = src + i * srcChannels;
+        unsigned char* out = dst + i * dstChannels;
+        for (int k = 0; k < 3; ++k) {
+            const unsigned char value = in[srcChannels >= 3 ? k : 0];
+            out[k] = table ? table[value] : value;
+        }
+        if (dstChannels == 4)
+            out[3] = srcChannels == 4 ? in[3] : srcChannels == 2 ? in[1] : 255; // alpha stays linear
+    }
+}
+
+#ifdef TEXTURE_X86_SIMD
+bool cpuHasSsse3() {
+    unsigned int info[4] = {0, 0, 0, 0};
+#ifdef _MSC_VER
+    __cpuid(reinterpret_cast<int*>(info), 1);
+#else
+    __get_cpuid(1, &info[0], &info[1], &info[2], &info[3]);
+#endif
+    return (info[2] & (1u << 9)) != 0;
+}
+
+// 16 RGB texels (48 bytes) to 16 RGBA texels (64 bytes) per iteration
+TEXTURE_TARGET_SSSE3 size_t expandRGBToRGBASsse3(const unsigned char* src, unsigned char* dst, const size_t count) {
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i + 16));
+        const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i + 32));
+        const __m128i p0 = a;                        // bytes 0-11
+        const __m128i p1 = _mm_alignr_epi8(b, a, 12); // bytes 12-23
+        const __m128i p2 = _mm_alignr_epi8(c, b, 8);  // bytes 24-35
+        const __m128i p3 = _mm_srli_si128(c, 4);      // bytes 36-47
+        __m128i* out = reinterpret_cast<__m128i*>(dst + 4 * i);
+        _mm_storeu_si128(out, _mm_or_si128(_mm_shuffle_epi8(p0, shuffle), alpha));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(p1, shuffle), alpha));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(p2, shuffle), alpha));
+        _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(p3, shuffle), alpha));
+    }
+    return i;
+}
+#endif
+
+// Converts count texels of srcChannels (1 to 4) to dstChannels (3 or 4) while
+// applying a transfer function to the color channels, in a single pass
+void convertPixels(const unsigned char* src, const int srcChannels, unsigned char* dst, const int dstChannels, const size_t count, const ColorTransfer transfer) {
+    size_t done = 0;
+#ifdef TEXTURE_X86_SIMD
+    static const bool hasSsse3 = cpuHasSsse3();
+    if (hasSsse3 && srcChannels == 3 && dstChannels == 4 && transfer == ColorTransfer::None)
+        done = expandRGBToRGBASsse3(src, dst, count);
+#endif
+    if (done == 0 && srcChannels == dstChannels && transfer == ColorTransfer::None) {
+        std::memcpy(dst, src, count * dstChannels);
+        return;
+    }
+    convertPixelsScalar(src + done * srcChannels, srcChannels, dst + done * dstChannels, dstChannels, count - done, transfer);
+}
+
+// Decode and conversion throughput of the given images: stb_image at their
+// native channel count, then the RGBA expansion through the scalar and the
+// SIMD paths, and an sRGB to linear conversion. Returns false if an image
+// cannot be decoded or the two RGBA paths disagree
+bool printDecodeBenchmark(const std::vector<std::string>& filenames, const int iterations = 10) {
+    typedef std::chrono::steady_clock Clock;
+    auto seconds = [](const Clock::time_point start) { return std::chrono::duration<double>(Clock::now() - start).count(); };
+#ifdef TEXTURE_X86_SIMD
+    std::cout << "SSSE3 RGBA expansion: " << (cpuHasSsse3() ? "yes" : "no") << std::endl;
+#endif
+    std::cout << std::left << std::setw(24) << "image" << std::setw(14) << "size" << std::setw(16) << "decode MB/s"
+              << std::setw(16) << "RGBA scalar" << std::setw(16) << "RGBA SIMD" << std::setw(16) << "sRGB->linear" << "(MB/s of output)" << std::endl;
+    bool ok = true;
+    for (const std::string& filename : filenames) {
+        MappedFile source;
+        if (!source.open(filename)) {
+            std::cout << "ERROR: Cannot load " << filename << std::endl;
+            ok = false;
+            continue;
+        }
+        int width = 0, height = 0, channels = 0;
+        std::shared_ptr<unsigned char> pixels;
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < iterations; ++i)
+            pixels.reset(stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &width, &height, &channels, 0), stbi_image_free);
+        const double decode = seconds(start);
+        if (!pixels) {
+            std::cout << "ERROR: Cannot decode " << filename << std::endl;
+            ok = false;
+            continue;
+        }
+        const size_t count = static_cast<size_t>(width) * height;
+        std::vector<unsigned char> scalar(4 * count), simd(4 * count), linear(4 * count);
+        start = Clock::now();
+        for (int i = 0; i < iterations; ++i)
+            convertPixelsScalar(pixels.get(), channels, scalar.data(), 4, count, ColorTransfer::None);
+        const double expandScalar = seconds(start);
+        start = Clock::now();
+        for (int i = 0; i < iterations; ++i)
+            convertPixels(pixels.get(), channels, simd.data(), 4, count, ColorTransfer::None);
+        const double expandSimd = seconds(start);
+        start = Clock::now();
+        for (int i = 0; i < iterations; ++i)
+            convertPixels(pixels.get(), channels, linear.data(), 4, count, ColorTransfer::SrgbToLinear);
+        const double toLinear = seconds(start);
+
+        const double decodedMB = static_cast<double>(count) * channels * iterations / 1e6, rgbaMB = 4.0 * count * iterations / 1e6;
+        std::cout << std::left << std::setw(24) << filename << std::setw(14) << (std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(channels))
+                  << std::setw(16) << std::fixed << std::setprecision(1) << decodedMB / decode << std::setw(16) << rgbaMB / expandScalar
+                  << std::setw(16) << rgbaMB / expandSimd << std::setw(16) << rgbaMB / toLinear
+                  << (scalar == simd ? "" : "MISMATCH between scalar and SIMD") << std::defaultfloat << std::endl;
+        ok = ok && scalar == simd;
+    }
+    return ok;
+}
+
+// ---- Decode cache ----
+// Decoded pixels of a source image, optionally resized and with their mips,
+// stored in <directory>/<key>.texcache. The key hashes the bytes of the source
+// and the decode options, so an edited image gets a new key and its stale
+// entry is simply never read again. Entries are written to a temporary file
+// and renamed, so that an interrupted write never leaves a truncated entry;
+// an entry that fails validation anyway (e.g. written by an older build) is
+// deleted, and rewritten by the decode that follows. Hits are memory-mapped
+// and the levels point straight into the mapping.
+
+struct DecodeOptions {
+    int desiredChannels = 0; // 3 or 4 to convert, 0 to keep what the file has
+    ColorTransfer transfer = ColorTransfer::None; // applied while converting
+    int resizeTo = 0;        // square size the image is resized to, 0 to keep its size
+    bool mips = false;       // full CPU mip chain
+};
+
+const uint32_t kDecodeCacheMagic = 0x43445854; // "TXDC"
+const uint32_t kDecodeCacheVersion = 2;        // bump when decoding or resampling changes
+
+struct DecodeCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t width; // level 0; level l is max(1, width >> l) x max(1, height >> l)
+    uint32_t height;
+    uint32_t channels;
+    uint32_t numLevels;
+    uint64_t payloadSize; // all levels, tightly packed, finest first
+};
+
+uint64_t decodeCacheKey(const MappedFile& source, const DecodeOptions& options) {
+    uint64_t key = fnv1a64(source.data(), source.size());
+    const int32_t params[5] = {static_cast<int32_t>(kDecodeCacheVersion), options.desiredChannels, static_cast<int32_t>(options.transfer), options.resizeTo, options.mips ? 1 : 0};
+    return fnv1a64(params, sizeof(params), key);
+}
+
+std::string decodeCachePath(const std::string& directory, const uint64_t key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.texcache", static_cast<unsigned long long>(key));
+    return directory + "/" + name;
+}
+
+// Levels of a valid entry, empty on a miss or when the entry does not match
+// its key, in which case the entry is deleted
+std::vector<Image> readDecodeCache(const std::string& path, const uint64_t key) {
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>();
+    if (!file->open(path))
+        return std::vector<Image>();
+    auto discard = [&]() {
+        file->close(); // a mapped file cannot be deleted on Windows
+        std::remove(path.c_str());
+        return std::vector<Image>();
+    };
+    if (file->size() < sizeof(DecodeCacheHeader))
+        return discard();
+    DecodeCacheHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (header.magic != kDecodeCacheMagic || header.version != kDecodeCacheVersion || header.key != key
+        || header.channels < 1 || header.channels > 4 || header.numLevels < 1 || header.numLevels > 32
+        || file->size() != sizeof(DecodeCacheHeader) + header.payloadSize)
+        return discard();
+
+    std::vector<Image> levels(header.numLevels);
+    size_t offset = sizeof(DecodeCacheHeader);
+    for (uint32_t l = 0; l < header.numLevels; ++l) {
+        levels[l].width = std::max(1, static_cast<int>(header.width) >> l);
+        levels[l].height = std::max(1, static_cast<int>(header.height) >> l);
+        levels[l].channels = header.channels;
+        if (offset + levels[l].byteSize() > file->size())
+            return discard();
+        // shares the ownership of the mapping; the texels are only ever read
+        levels[l].pixels = std::shared_ptr<unsigned char>(file, const_cast<unsigned char*>(file->data() + offset));
+        offset += levels[l].byteSize();
+    }
+    return levels;
+}
+
+bool writeDecodeCache(const std::string& directory, const uint64_t key, const std::vector<Image>& levels) {
+    if (!createDirectory(directory))
+        return false;
+    DecodeCacheHeader header;
+    header.magic = kDecodeCacheMagic;
+    header.version = kDecodeCacheVersion;
+    header.key = key;
+    header.width = levels.front().width;
+    header.height = levels.front().height;
+    header.channels = levels.front().channels;
+    header.numLevels = static_cast<uint32_t>(levels.size());
+    header.payloadSize = 0;
+    for (const Image& level : levels)
+        header.payloadSize += level.byteSize();
+
+    const std::string path = decodeCachePath(directory, key);
+    const std::string tempPath = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+    FILE* file = std::fopen(tempPath.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    for (const Image& level : levels)
+        written = written && std::fwrite(level.pixels.get(), 1, level.byteSize(), file) == level.byteSize();
+    written = std::fclose(file) == 0 && written;
+    std::remove(path.c_str()); // rename() does not replace on Windows
+    if (!written || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Decoded levels of an image, from the cache when cacheDirectory is set and
+// holds an entry for the current content of the file; safe on any thread.
+// Empty when the image cannot be read.
+std::vector<Image> decodeLevels(const std::string& filename, const DecodeOptions& options, const std::string& cacheDirectory) {
+    MappedFile source;
+    if (!source.open(filename)) {
+        std::cout << "ERROR: Cannot load " << filename << std::endl;
+        return std::vector<Image>();
+    }
+    uint64_t key = 0;
+    if (!cacheDirectory.empty()) {
+        key = decodeCacheKey(source, options);
+        std::vector<Image> cached = readDecodeCache(decodeCachePath(cacheDirectory, key), key);
+        if (!cached.empty())
+            return cached;
+    }
+
+    // decoded from the mapping, so the file is read once for the hash and the decode
+    Image image;
+    // at the native channel count, the fastest for stb_image, then converted in one pass
+    unsigned char* data = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &image.width, &image.height, &image.channels, 0);
+    if (!data) {
+        std::cout << "ERROR: Cannot load " << filename << ": " << stbi_failure_reason() << std::endl;
+        return std::vector<Image>();
+    }
+    image.pixels = std::shared_ptr<unsigned char>(data, stbi_image_free);
+    if ((options.desiredChannels && options.desiredChannels != image.channels) || options.transfer != ColorTransfer::None) {
+        Image converted;
+        converted.width = image.width;
+        converted.height = image.height;
+        converted.channels = options.desiredChannels ? options.desiredChannels : std::max(image.channels, 3);
+        converted.pixels = std::shared_ptr<unsigned char>(new unsigned char[converted.byteSize()], std::default_delete<unsigned char[]>());
+        convertPixels(image.pixels.get(), image.channels, converted.pixels.get(), converted.channels, static_cast<size_t>(image.width) * image.height, options.transfer);
+        image = converted;
+    }
+    if (options.resizeTo > 0)
+        image = resizeImage(image, options.resizeTo, options.resizeTo);
+    std::vector<Image> levels = options.mips ? generateMipChain(image) : std::vector<Image>(1, image);
+
+    if (!cacheDirectory.empty() && !writeDecodeCache(cacheDirectory, key, levels))
+        std::cout << "WARNING: Cannot write the decode cache entry of " << filename << " in " << cacheDirectory << std::endl;
+    return levels;
+}
+
+// Offline converted version of a texture: same path with a .dds extension
+std::string compressedTexturePath(const std::string& filename) {
+    const size_t dot = filename.find_last_of('.');
+    const size_t slash = filename.find_last_of("/\\");
+    const bool hasExtension = dot != std::string::npos && (slash == std::string::npos || dot > slash);
+    return (hasExtension ? filename.substr(0, dot) : filename) + ".dds";
+}
+
+// Uploads the levels of a mapped BC1 DDS file into a 2D texture (layer < 0)
+// or one layer of a 2D array texture. With compressedStorage, the blocks are
+// handed to the driver straight from the mapping; otherwise the texture is
+// RGB8 and the levels are decoded on the CPU first.
+void uploadDdsLevels(const GLuint texID, const DdsTexture& dds, const GLint layer, const bool compressedStorage) {
+    const std::vector<DdsLevel>& levels = dds.levels();
+    std::vector<unsigned char> rgb;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (GLint l = 0; l < static_cast<GLint>(levels.size()); ++l) {
+        const DdsLevel& level = levels[l];
+        if (compressedStorage) {
+            if (layer < 0)
+                glCompressedTextureSubImage2D(texID, l, 0, 0, level.width, level.height, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, static_cast<GLsizei>(level.size), level.data);
+            else
+                glCompressedTextureSubImage3D(texID, l, 0, 0, layer, level.width, level.height, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, static_cast<GLsizei>(level.size), level.data);
+            continue;
+        }
+        rgb.resize(3 * static_cast<size_t>(level.width) * level.height);
+        decodeBC1(level.data, level.width, level.height, rgb.data());
+        if (layer < 0)
+            glTextureSubImage2D(texID, l, 0, 0, level.width, level.height, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+        else
+            glTextureSubImage3D(texID, l, 0, 0, layer, level.width, level.height, 1, GL_RGB, GL_UNSIGNED_BYTE, rgb.data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Creates an immutable texture from a mapped BC1 DDS file, kept compressed
+// unless the driver lacks S3TC
+GLuint createTextureFromDds(const DdsTexture& dds, const TextureSampling& sampling) {
+    const GLsizei numLevels = static_cast<GLsizei>(dds.levels().size());
+    const bool compressed = GLAD_GL_EXT_texture_compression_s3tc != 0;
+    GLuint texID; // OpenGL texture identifier
+    glCreateTextures(GL_TEXTURE_2D, 1, &texID);
+    applySampling(texID, numLevels, sampling);
+    glTextureStorage2D(texID, numLevels, compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8, dds.width(), dds.height());
+    uploadDdsLevels(texID, dds, -1, compressed);
+    return texID;
+}
+
+// Synchronous path: the converted .dds when there is one, otherwise decode (or
+// read from the decode cache when cacheDirectory is set) then upload, blocking the caller
+GLuint loadTextureFromFileToGPU(const std::string& filename, const TextureSampling& sampling = TextureSampling(), const std::string& cacheDirectory = "") {
+    DdsTexture dds;
+    if (dds.open(compressedTexturePath(filename)))
+        return createTextureFromDds(dds, sampling);
+    DecodeOptions options;
+    options.mips = sampling.mips == MipGeneration::Cpu;
+    const std::vector<Image> levels = decodeLevels(filename, options, cacheDirectory);
+    if (levels.empty())
+        return 0;
+    return createTextureFromImages(levels, sampling, nullptr);
+}
+
+
+// Asset conversion: writes the BC1 DDS version of an image, with its CPU mip
+// chain, next to it. Returns false when the image cannot be read or written.
+bool convertTextureToDds(const std::string& filename) {
+    const Image image = decodeImage(filename);
+    if (!image.valid())
+        return false;
+    std::vector<std::vector<unsigned char>> blocks;
+    for (const Image& level : generateMipChain(image))
+        blocks.push_back(encodeBC1(level.pixels.get(), level.width, level.height, level.channels));
+    const std::string output = compressedTexturePath(filename);
+    if (!writeDdsBC1(output, image.width, image.height, blocks)) {
+        std::cout << "ERROR: Cannot write " << output << std::endl;
+        return false;
+    }
+    size_t compressedSize = 0;
+    for (const std::vector<unsigned char>& level : blocks)
+        compressedSize += level.size();
+    std::cout << filename << " -> " << output << ": " << blocks.size() << " levels, " << compressedSize / 1024 << " KiB (RGBA8 with mips: "
+              << image.width * image.height * 4 * 4 / 3 / 1024 << " KiB)" << std::endl;
+    return true;
+}
+
+// Peak signal to noise ratio, in dB, between two RGB images of the same size
+double psnrRGB(const unsigned char* a, const unsigned char* b, const size_t numBytes) {
+    double squaredError = 0.0;
+    for (size_t i = 0; i < numBytes; ++i) {
+        const double d = static_cast<double>(a[i]) - b[i];
+        squaredError += d * d;
+    }
+    if (squaredError == 0.0)
+        return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(255.0 * 255.0 * numBytes / squaredError);
+}
+
+// Encodes an image and its mips to BC1, writes them to a DDS file, maps it
+// back and checks that the container returns the same blocks, then decodes
+// level 0 and compares it with the source. Prints one row and returns false
+// when the file does not round-trip or the PSNR is below minPsnr.
+bool checkBC1RoundTrip(const std::string& name, const Image& image, const double minPsnr) {
+    std::vector<Image> chain = generateMipChain(image);
+    std::vector<std::vector<unsigned char>> blocks;
+    for (const Image& level : chain)
+        blocks.push_back(encodeBC1(level.pixels.get(), level.width, level.height, level.channels));
+
+    const std::string tempFile = "bc1_check.dds";
+    bool containerOk = writeDdsBC1(tempFile, image.width, image.height, blocks);
+    double psnr = 0.0;
+    {
+        DdsTexture dds;
+        containerOk = containerOk && dds.open(tempFile) && dds.width() == image.width && dds.height() == image.height && dds.levels().size() == blocks.size();
+        for (size_t l = 0; containerOk && l < blocks.size(); ++l)
+            containerOk = dds.levels()[l].size == blocks[l].size() && std::memcmp(dds.levels()[l].data, blocks[l].data(), blocks[l].size()) == 0;
+
+        if (containerOk) {
+            std::vector<unsigned char> source(3 * static_cast<size_t>(image.width) * image.height);
+            for (size_t t = 0; t < source.size() / 3; ++t)
+                for (int k = 0; k < 3; ++k)
+                    source[3 * t + k] = image.pixels.get()[t * image.channels + (image.channels >= 3 ? k : 0)];
+            std::vector<unsigned char> decoded(source.size());
+            decodeBC1(dds.levels()[0].data, image.width, image.height, decoded.data());
+            psnr = psnrRGB(source.data(), decoded.data(), source.size());
+        }
+    }
+    std::remove(tempFile.c_str());
+
+    const bool passed = containerOk && psnr >= minPsnr;
+    std::cout << std::left << std::setw(24) << name << std::setw(10) << blocks.size() << std::setw(12) << (containerOk ? "ok" : "FAILED")
+              << std::setw(12) << std::setprecision(4) << psnr << std::setw(10) << minPsnr << (passed ? "ok" : "FAILED") << std::endl;
+    return passed;
+}
+
+// Runs checkBC1RoundTrip() on synthetic images and on the given files, without a GPU
+bool printBC1RoundTripCheck(const std::vector<std::string>& filenames) {
+    std::cout << std::left << std::setw(24) << "image" << std::setw(10) << "levels" << std::setw(12) << "container"
+              << std::setw(12) << "PSNR (dB)" << std::setw(10) << "min" << "result" << std::endl;
+    auto synthetic = [](const int width, const int height, const int channels, unsigned char (*texel)(int x, int y, int k)) {
+        Image image;
+        image.width = width;
+        image.height = height;
+        image.channels = channels;
+        image.pixels = std::shared_ptr<unsigned char>(new unsigned char[image.byteSize()], std::default_delete<unsigned char[]>());
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                for (int k = 0; k < channels; ++k)
+                    image.pixels.get()[(static_cast<size_t>(y) * width + x) * channels + k] = texel(x, y, k);
+        return image;
+    };
+    bool passed = true;
+    passed = checkBC1RoundTrip("solid 64x64 rgb", synthetic(64, 64, 3, [](int, int, int k) { return static_cast<unsigned char>(40 + 70 * k); }), 40.0) && passed;
+    passed = checkBC1RoundTrip("gradient 256x128 rgb", synthetic(256, 128, 3, [](int x, int y, int k) { return static_cast<unsigned char>(k == 0 ? x : k == 1 ? 2 * y : (x + y) / 2); }), 35.0) && passed;
+    passed = checkBC1RoundTrip("two-tone 30x18 rgba", synthetic(30, 18, 4, [](int x, int y, int k) { return static_cast<unsigned char>(((x / 3 + y / 3) % 2) ? 200 - 50 * k : 20 + 30 * k); }), 35.0) && passed;
+    passed = checkBC1RoundTrip("grey ramp 7x5", synthetic(7, 5, 1, [](int x, int y, int) { return static_cast<unsigned char>(30 * x + 10 * y); }), 28.0) && passed;
+    for (const std::string& filename : filenames) {
+        const Image image = decodeImage(filename);
+        passed = image.valid() && checkBC1RoundTrip(filename, image, 30.0) && passed;
+    }
+    std::cout << (passed ? "All BC1 round trips passed" : "Some BC1 round trips failed") << std::endl;
+    return passed;
+}
+
+// Decodes images on a pool of worker threads, starting before any GL context
+// exists, and uploads them on the GL thread as they become ready. Requests
+// either get a texture of their own, which points to a shared 1x1 placeholder
+// until it is ready, or a layer of one GL_TEXTURE_2D_ARRAY shared by all layer
+// requests, so that draws select their map per instance without rebinding.
+// Layers are resized to the common array size and stay grey until uploaded.
+class AsyncTextureLoader {
+public:
+    explicit AsyncTextureLoader(const TextureSampling& sampling = TextureSampling()) : m_sampling(sampling) {}
+    ~AsyncTextureLoader() { shutdown(); }
+
+    // Starts decoding right away; *target receives the texture ID once initGL() ran
+    void enqueue(const std::string& filename, GLuint* target);
+    // Same for a layer of the array texture; the array is arraySize x arraySize texels
+    void enqueueLayer(const std::string& filename, const GLint layer);
+    void setArraySize(const int arraySize) { m_arraySize = arraySize; } // before the first enqueueLayer()
+    void setDecodeCache(const std::string& directory) { m_decodeCache = directory; } // before the first enqueue, empty to disable
+    // Needs a current GL context: creates the placeholder and the array, and points every target to the placeholder
+    void initGL();
+    // Uploads the decoded images that are ready, without waiting for the others
+    void uploadReady();
+    // Blocks until every image is decoded and uploaded
+    void finish();
+    bool done() const { return m_numUploaded == m_requests.size(); }
+    void shutdown(); // with the GL context still current when initGL() ran: releases the upload buffers
+
+    GLuint arrayTexture() const { return m_array; } // 0 when there are no layer requests
+
+private:
+    struct Request {
+        std::string filename;
+        GLuint* target; // nullptr for layer requests
+        GLint layer;
+    };
+    struct Decoded {
+        size_t request;
+        std::shared_ptr<DdsTexture> compressed; // set when a usable converted .dds was found
+        std::vector<Image> levels; // empty when decoding failed
+    };
+
+    void startWorkers();
+    void workerLoop();
+    void decode(const Request& request, Decoded& decoded) const;
+    bool ddsFitsArray(const DdsTexture& dds) const;
+    void upload(Decoded& decoded);
+    void uploadLayer(Decoded& decoded, const GLint layer);
+
+    const TextureSampling m_sampling;
+    int m_arraySize = 1024;
+    std::string m_decodeCache;
+    std::vector<Request> m_requests;
+    std::deque<size_t> m_pending;   // requests not picked by a worker yet
+    std::deque<Decoded> m_decoded;  // decoded images waiting for the GL thread
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::condition_variable m_imageDecoded;
+    bool m_stopping = false;
+    size_t m_numUploaded = 0;
+    GLuint m_placeholder = 0;
+    GLuint m_array = 0;
+    PixelUploadRing m_uploadRing;
+    bool m_arrayCompressed = false; // BC1 when every layer has a fitting .dds and the driver has S3TC, RGBA8 otherwise
+};
+
+void AsyncTextureLoader::enqueue(const std::string& filename, GLuint* target) {
+    if (m_workers.empty())
+        startWorkers();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requests.push_back({filename, target, -1});
+    m_pending.push_back(m_requests.size() - 1);
+    m_workAvailable.notify_one();
+}
+
+void AsyncTextureLoader::enqueueLayer(const std::string& filename, const GLint layer) {
+    if (m_workers.empty())
+        startWorkers();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_requests.push_back({filename, nullptr, layer});
+    m_pending.push_back(m_requests.size() - 1);
+    m_workAvailable.notify_one();
+}
+
+void AsyncTextureLoader::startWorkers() {
+    const unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int t = 0; t < numThreads; ++t)
+        m_workers.emplace_back(&AsyncTextureLoader::workerLoop, this);
+}
+
+// Converted textures go into the array as is only when they have its size and a full mip chain
+bool AsyncTextureLoader::ddsFitsArray(const DdsTexture& dds) const {
+    return dds.width() == m_arraySize && dds.height() == m_arraySize && static_cast<int>(dds.levels().size()) == mipLevelCount(m_arraySize, m_arraySize);
+}
+
+void AsyncTextureLoader::decode(const Request& request, Decoded& decoded) const {
+    // mapping a converted texture is much cheaper than decoding the source image
+    std::shared_ptr<DdsTexture> compressed = std::make_shared<DdsTexture>();
+    if (compressed->open(compressedTexturePath(request.filename)) && (request.layer < 0 || ddsFitsArray(*compressed))) {
+        decoded.compressed = compressed;
+        return;
+    }
+    DecodeOptions options;
+    if (request.layer < 0) {
+        options.mips = m_sampling.mips == MipGeneration::Cpu;
+    } else {
+        options.desiredChannels = 4; // the array is RGBA: 4 byte texels are uploaded without driver side repacking
+        options.resizeTo = m_arraySize;
+        options.mips = true;
+    }
+    decoded.levels = decodeLevels(request.filename, options, m_decodeCache);
+}
+
+void AsyncTextureLoader::workerLoop() {
+    for (;;) {
+        Decoded decoded;
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_workAvailable.wait(lock, [this] { return m_stopping || !m_pending.empty(); });
+            if (m_stopping)
+                return;
+            decoded.request = m_pending.front();
+            m_pending.pop_front();
+            request = m_requests[decoded.request];
+        }
+        decode(request, decoded); // the slow part, outside the lock
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_decoded.push_back(decoded);
+        m_imageDecoded.notify_all();
+    }
+}
+
+void AsyncTextureLoader::initGL() {
+    const unsigned char grey[3] = {128, 128, 128};
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_placeholder);
+    glTextureStorage2D(m_placeholder, 1, GL_RGB8, 1, 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTextureSubImage2D(m_placeholder, 0, 0, 0, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, grey);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    m_uploadRing.init();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    GLint numLayers = 0;
+    m_arrayCompressed = GLAD_GL_EXT_texture_compression_s3tc != 0;
+    for (const Request& request : m_requests) {
+        if (request.target) {
+            *request.target = m_placeholder;
+            continue;
+        }
+        numLayers = std::max(numLayers, request.layer + 1);
+        DdsTexture dds; // only the header is read here
+        m_arrayCompressed = m_arrayCompressed && dds.open(compressedTexturePath(request.filename)) && ddsFitsArray(dds);
+    }
+    if (numLayers == 0)
+        return;
+
+    const int numLevels = mipLevelCount(m_arraySize, m_arraySize);
+    glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &m_array);
+    applySampling(m_array, numLevels, m_sampling);
+    glTextureStorage3D(m_array, numLevels, m_arrayCompressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGBA8, m_arraySize, m_arraySize, numLayers);
+
+    // Grey layers until the real ones are uploaded: one block repeated for BC1, a clear for RGB8
+    if (m_arrayCompressed) {
+        float texels[16][3];
+        for (int t = 0; t < 16; ++t)
+            for (int k = 0; k < 3; ++k)
+                texels[t][k] = grey[k];
+        unsigned char block[kBC1BlockBytes];
+        encodeBC1Block(texels, block);
+        std::vector<unsigned char> blocks;
+        for (int l = 0; l < numLevels; ++l) {
+            const int size = std::max(1, m_arraySize >> l);
+            const size_t levelSize = bc1Size(size, size) * numLayers;
+            blocks.resize(levelSize);
+            for (size_t offset = 0; offset < levelSize; offset += kBC1BlockBytes)
+                std::memcpy(blocks.data() + offset, block, kBC1BlockBytes);
+            glCompressedTextureSubImage3D(m_array, l, 0, 0, 0, size, size, numLayers, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, static_cast<GLsizei>(levelSize), blocks.data());
+        }
+    } else {
+        for (int l = 0; l < numLevels; ++l)
+            glClearTexImage(m_array, l, GL_RGB, GL_UNSIGNED_BYTE, grey); // alpha is filled with 1
+    }
+}
+
+void AsyncTextureLoader::uploadLayer(Decoded& decoded, const GLint layer) {
+    if (decoded.compressed) {
+        uploadDdsLevels(m_array, *decoded.compressed, layer, m_arrayCompressed);
+    } else if (!decoded.levels.empty()) {
+        if (m_arrayCompressed) {
+            // the .dds vanished since initGL(): encode here rather than leave the layer grey
+            for (size_t l = 0; l < decoded.levels.size(); ++l) {
+                const Image& level = decoded.levels[l];
+                const std::vector<unsigned char> blocks = encodeBC1(level.pixels.get(), level.width, level.height, level.channels);
+                glCompressedTextureSubImage3D(m_array, static_cast<GLint>(l), 0, 0, layer, level.width, level.height, 1, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, static_cast<GLsizei>(blocks.size()), blocks.data());
+            }
+        } else {
+            uploadImageLevels(m_array, decoded.levels, layer, &m_uploadRing);
+        }
+    }
+}
+
+void AsyncTextureLoader::upload(Decoded& decoded) {
+    const Request& request = m_requests[decoded.request];
+    if (!request.target)
+        uploadLayer(decoded, request.layer);
+    else if (decoded.compressed)
+        *request.target = createTextureFromDds(*decoded.compressed, m_sampling);
+    else if (!decoded.levels.empty())
+        *request.target = createTextureFromImages(decoded.levels, m_sampling, &m_uploadRing);
+    ++m_numUploaded;
+}
+
+void AsyncTextureLoader::uploadReady() {
+    std::deque<Decoded> ready;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ready.swap(m_decoded);
+    }
+    for (Decoded& decoded : ready)
+        upload(decoded);
+}
+
+void AsyncTextureLoader::finish() {
+    while (!done()) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_imageDecoded.wait(lock, [this] { return !m_decoded.empty(); });
+        }
+        uploadReady();
+    }
+}
+
+void AsyncTextureLoader::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_workAvailable.notify_all();
+    for (std::thread& worker : m_workers)
+        worker.join();
+    m_workers.clear();
+    m_uploadRing.destroy(); // nothing left to release when called again from the destructor
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef _TIMESTEP_
+#define _TIMESTEP_
+
+// Fixed timestep clock: the wall clock time elapsed between frames is
+// accumulated and consumed in steps of exactly dt(), so the simulation runs
+// at its own rate whatever the frame rate. What is left in the accumulator
+// (less than one step) gives alpha(), the position of the frame between the
+// two latest simulated states, for the renderer to interpolate: the display
+// stays smooth even when the simulation runs slower than the frames, at the
+// cost of showing the state one step late.
+
+#include <algorithm>
+
+class FixedTimestep {
+public:
+    explicit FixedTimestep(const double rate = 240.0) { setRate(rate); }
+
+    void setRate(const double rate) { m_dt = 1.0 / rate; } // steps per second
+    // Elapsed time longer than this is dropped, so a slow frame (or a pause
+    // in a debugger) cannot require ever more steps to catch up. Infinite
+    // when every frame must be simulated, as for offline rendering.
+    void setMaxFrameTime(const double seconds) { m_maxFrameTime = seconds; }
+
+    // Number of steps to run to reach the given time of the wall clock,
+    // which starts with the simulation at 0
+    int advance(const double now);
+    void reset() { m_previous = 0.0; m_accumulator = 0.0; }
+
+    double dt() const { return m_dt; }
+    float alpha() const { return static_cast<float>(m_accumulator / m_dt); } // in [0, 1)
+
+private:
+    double m_dt = 0.0;
+    double m_maxFrameTime = 0.25;
+    double m_previous = 0.0;
+    double m_accumulator = 0.0;
+};
+
+int FixedTimestep::advance(const double now) {
+    m_accumulator += std::min(now - m_previous, m_maxFrameTime);
+    m_previous = now;
+    int steps = 0;
+    while (m_accumulator >= m_dt) {
+        m_accumulator -= m_dt;
+        ++steps;
+    }
+    return steps;
+}
+
+#endif
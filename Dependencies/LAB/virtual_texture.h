@@ -0,0 +1,471 @@
+#ifndef _VIRTUAL_TEXTURE_
+#define _VIRTUAL_TEXTURE_
+
+// Virtual texturing for surface maps too large for RAM or VRAM. The image and
+// its mips are cut offline into square tiles stored in a page file. At run
+// time only the tiles the camera actually sees are copied into a fixed-size
+// cache texture, and an indirection texture tells the fragment shader where
+// each tile lives (or which coarser ancestor to fall back to):
+//  - a feedback pass renders, at 1/kFeedbackScale of the viewport, the level
+//    and tile wanted by every fragment into an R32UI target;
+//  - it is read back through a PBO on the next frame, or the one after if the
+//    GPU is not done with it yet, so it never stalls;
+//  - missing tiles are uploaded from the memory-mapped page file, coarsest
+//    first and within a per-frame budget, evicting the least recently seen.
+// Memory use is the cache, the indirection table (4 bytes per tile of every
+// level) and the feedback buffers, whatever the size of the source image.
+
+#include <glad/glad.h>
+
+#include "dds.h"
+#include "program.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const uint32_t kPageFileMagic = 0x46505456; // "VTPF"
+const int kVirtualTextureMaxLevels = 16;    // size of the vtLevelRows uniform array
+
+// Followed by the tiles of every level, finest first, each level row major.
+// A tile is (tileSize + 2 * border)^2 RGB8 texels, rows top to bottom.
+struct PageFileHeader {
+    uint32_t magic;
+    uint32_t width;     // level 0, in texels
+    uint32_t height;
+    uint32_t tileSize;  // useful texels per tile side
+    uint32_t border;    // texels repeated around each tile, for bilinear filtering across tiles
+    uint32_t numLevels; // down to the first level that fits in one tile
+};
+
+inline int levelSize(const int size, const int level) { return std::max(1, size >> level); }
+inline int tileCount(const int size, const int level, const int tileSize) { return (levelSize(size, level) + tileSize - 1) / tileSize; }
+
+// Offline step: cuts an image and its box filtered mips into a page file. The
+// borders wrap horizontally (longitude) and are clamped vertically (poles).
+// The source is decoded in memory, so this is the one step that does not scale
+// to arbitrary sizes; run time memory does.
+bool buildPageFile(const std::string& imageFile, const std::string& pageFile, const int tileSize = 128, const int border = 4) {
+    const Image image = decodeImage(imageFile, 3);
+    if (!image.valid())
+        return false;
+    PageFileHeader header;
+    header.magic = kPageFileMagic;
+    header.width = image.width;
+    header.height = image.height;
+    header.tileSize = tileSize;
+    header.border = border;
+    header.numLevels = 1;
+    while (tileCount(image.width, header.numLevels - 1, tileSize) > 1 || tileCount(image.height, header.numLevels - 1, tileSize) > 1)
+        ++header.numLevels;
+    if (header.numLevels > static_cast<uint32_t>(kVirtualTextureMaxLevels)) {
+        std::cout << "ERROR: " << imageFile << " needs more than " << kVirtualTextureMaxLevels << " levels, use larger tiles" << std::endl;
+        return false;
+    }
+
+    FILE* file = std::fopen(pageFile.c_str(), "wb");
+    if (!file) {
+        std::cout << "ERROR: Cannot write " << pageFile << std::endl;
+        return false;
+    }
+    std::fwrite(&header, sizeof(header), 1, file);
+    const int padded = tileSize + 2 * border;
+    std::vector<unsigned char> tile(3 * padded * padded);
+    Image level = image;
+    size_t numTiles = 0;
+    for (uint32_t l = 0; l < header.numLevels; ++l) {
+        if (l > 0)
+            level = downsampleBox(level);
+        const int tilesX = tileCount(image.width, l, tileSize), tilesY = tileCount(image.height, l, tileSize);
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                for (int y = 0; y < padded; ++y) {
+                    const int sy = std::min(std::max(ty * tileSize + y - border, 0), level.height - 1);
+                    for (int x = 0; x < padded; ++x) {
+                        const int sx = ((tx * tileSize + x - border) % level.width + level.width) % level.width;
+                        std::memcpy(&tile[3 * (y * padded + x)], level.pixels.get() + 3 * (static_cast<size_t>(sy) * level.width + sx), 3);
+                    }
+                }
+                std::fwrite(tile.data(), 1, tile.size(), file);
+                ++numTiles;
+            }
+        }
+    }
+    std::fclose(file);
+    std::cout << imageFile << " -> " << pageFile << ": " << header.numLevels << " levels, " << numTiles << " tiles of " << tileSize << "+" << 2 * border << " texels" << std::endl;
+    return true;
+}
+
+
+class VirtualTexture {
+public:
+    bool open(const std::string& pageFile); // maps the page file; false when missing or invalid
+    bool isOpen() const { return m_file.isOpen(); }
+    // cacheSlots x cacheSlots tiles of physical cache
+    void initGL(const int cacheSlots);
+    void destroy();
+
+    // Constants of the page file. The samplers vtCache and vtIndirection are
+    // the caller's: they must get their own units even when no page file is
+    // loaded, since samplers of different types cannot share one.
+    void setUniforms(const Program& program) const;
+    void bind(const GLuint cacheUnit) const; // the cache on cacheUnit, the indirection on cacheUnit + 1
+
+    // Redirects the draws in between to the feedback target, drawn with a feedback program
+    void beginFeedback();
+    void endFeedback();
+    // With synchronous feedback, endFeedback() reads the target back right
+    // away and update() has no upload budget: used to render exact frames
+    void setSynchronousFeedback(const bool synchronous) { m_synchronous = synchronous; }
+
+    // Requests the tiles of the latest feedback and uploads up to maxUploads of them
+    void update(const size_t maxUploads);
+    bool hasMisses() const; // the latest feedback wants tiles that are not in the cache
+
+    size_t residentTiles() const { return m_slotOfTile.size(); }
+    size_t uploadedTiles() const { return m_numUploads; }
+
+    static const int kFeedbackScale = 8;
+
+private:
+    struct Slot {
+        uint32_t tile;   // key of the tile held, see tileKey()
+        bool pinned;     // coarsest level, always resident so that every lookup has a fallback
+    };
+    static uint32_t tileKey(const int level, const int x, const int y) { return (static_cast<uint32_t>(level) << 26) | (static_cast<uint32_t>(y) << 13) | static_cast<uint32_t>(x); }
+    static int keyLevel(const uint32_t key) { return (key >> 26) & 31; }
+    static int keyY(const uint32_t key) { return (key >> 13) & 8191; }
+    static int keyX(const uint32_t key) { return key & 8191; }
+
+    const unsigned char* tileData(const uint32_t key) const;
+    void load(const uint32_t key, const bool pinned);
+    void rebuildIndirection();
+    void resizeFeedback(const int width, const int height);
+    void decodeFeedback(const GLuint* values, const size_t count);
+
+    MappedFile m_file;
+    PageFileHeader m_header;
+    std::vector<size_t> m_levelFirstTile; // index of the first tile of each level in the page file
+    std::vector<GLint> m_levelRows;       // first row of each level in the indirection texture
+
+    int m_cacheSlots = 0;
+    GLuint m_cacheTexture = 0;
+    GLuint m_indirectionTexture = 0;
+    std::vector<Slot> m_slots;
+    std::vector<uint32_t> m_freeSlots;
+    std::unordered_map<uint32_t, uint32_t> m_slotOfTile;
+    std::list<uint32_t> m_lru; // non pinned slots, most recently seen first
+    std::unordered_map<uint32_t, std::list<uint32_t>::iterator> m_lruPosition;
+    std::vector<unsigned char> m_indirection; // RGBA8UI: slot x, slot y, resident level, 1
+    bool m_indirectionDirty = false;
+    size_t m_numUploads = 0;
+
+    GLuint m_feedbackFbo = 0;
+    GLuint m_feedbackTexture = 0;
+    GLuint m_feedbackDepth = 0;
+    int m_feedbackWidth = 0;
+    int m_feedbackHeight = 0;
+    GLuint m_feedbackPbos[2] = {0, 0};
+    GLsync m_feedbackFences[2] = {nullptr, nullptr};
+    int m_feedbackNext = 0;
+    GLint m_savedFramebuffer = 0;
+    GLint m_savedViewport[4] = {0, 0, 0, 0};
+    bool m_synchronous = false;
+    std::vector<uint32_t> m_requested; // unique tiles of the latest feedback
+};
+
+bool VirtualTexture::open(const std::string& pageFile) {
+    if (!m_file.open(pageFile))
+        return false;
+    if (m_file.size() < sizeof(PageFileHeader)) {
+        m_file.close();
+        return false;
+    }
+    std::memcpy(&m_header, m_file.data(), sizeof(PageFileHeader));
+    if (m_header.magic != kPageFileMagic || m_header.numLevels == 0 || m_header.numLevels > static_cast<uint32_t>(kVirtualTextureMaxLevels)) {
+        m_file.close();
+        return false;
+    }
+    const int tileSize = m_header.tileSize;
+    size_t numTiles = 0;
+    GLint rows = 0;
+    m_levelFirstTile.clear();
+    m_levelRows.assign(kVirtualTextureMaxLevels, 0);
+    for (uint32_t l = 0; l < m_header.numLevels; ++l) {
+        m_levelFirstTile.push_back(numTiles);
+        m_levelRows[l] = rows;
+        numTiles += static_cast<size_t>(tileCount(m_header.width, l, tileSize)) * tileCount(m_header.height, l, tileSize);
+        rows += tileCount(m_header.height, l, tileSize);
+    }
+    const size_t padded = tileSize + 2 * m_header.border;
+    if (m_file.size() < sizeof(PageFileHeader) + numTiles * 3 * padded * padded) {
+        std::cout << "ERROR: Truncated page file " << pageFile << std::endl;
+        m_file.close();
+        return false;
+    }
+    return true;
+}
+
+const unsigned char* VirtualTexture::tileData(const uint32_t key) const {
+    const int level = keyLevel(key);
+    const size_t padded = m_header.tileSize + 2 * m_header.border;
+    const size_t index = m_levelFirstTile[level] + static_cast<size_t>(keyY(key)) * tileCount(m_header.width, level, m_header.tileSize) + keyX(key);
+    return m_file.data() + sizeof(PageFileHeader) + index * 3 * padded * padded;
+}
+
+void VirtualTexture::initGL(const int cacheSlots) {
+    const int lastLevel = m_header.numLevels - 1;
+    const int padded = m_header.tileSize + 2 * m_header.border;
+    m_cacheSlots = std::min(std::max(cacheSlots, 2), 256); // slot coordinates are stored on 8 bits
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_cacheTexture);
+    glTextureStorage2D(m_cacheTexture, 1, GL_RGB8, m_cacheSlots * padded, m_cacheSlots * padded);
+    glTextureParameteri(m_cacheTexture, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(m_cacheTexture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(m_cacheTexture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(m_cacheTexture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    const int tilesX = tileCount(m_header.width, 0, m_header.tileSize);
+    const int rows = m_levelRows[lastLevel] + tileCount(m_header.height, lastLevel, m_header.tileSize);
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_indirectionTexture);
+    glTextureStorage2D(m_indirectionTexture, 1, GL_RGBA8UI, tilesX, rows);
+    glTextureParameteri(m_indirectionTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(m_indirectionTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    m_indirection.assign(4 * static_cast<size_t>(tilesX) * rows, 0);
+
+    m_slots.assign(m_cacheSlots * m_cacheSlots, Slot{0, false});
+    m_freeSlots.clear();
+    for (uint32_t s = static_cast<uint32_t>(m_slots.size()); s-- > 0;)
+        m_freeSlots.push_back(s);
+
+    // The coarsest level is a single tile, always resident
+    for (int y = 0; y < tileCount(m_header.height, lastLevel, m_header.tileSize); ++y)
+        for (int x = 0; x < tileCount(m_header.width, lastLevel, m_header.tileSize); ++x)
+            load(tileKey(lastLevel, x, y), true);
+    rebuildIndirection();
+
+    glCreateBuffers(2, m_feedbackPbos);
+}
+
+void VirtualTexture::destroy() {
+    glDeleteTextures(1, &m_cacheTexture);
+    glDeleteTextures(1, &m_indirectionTexture);
+    glDeleteTextures(1, &m_feedbackTexture);
+    glDeleteRenderbuffers(1, &m_feedbackDepth);
+    glDeleteFramebuffers(1, &m_feedbackFbo);
+    glDeleteBuffers(2, m_feedbackPbos);
+    for (GLsync& fence : m_feedbackFences) {
+        if (fence) glDeleteSync(fence);
+        fence = nullptr;
+    }
+    m_file.close();
+}
+
+void VirtualTexture::setUniforms(const Program& program) const {
+    program.set("vtSize", glm::vec2(m_header.width, m_header.height));
+    program.set("vtTileSize", static_cast<GLint>(m_header.tileSize));
+    program.set("vtBorder", static_cast<GLint>(m_header.border));
+    program.set("vtNumLevels", static_cast<GLint>(m_header.numLevels));
+    program.set("vtLevelRows", m_levelRows);
+    program.set("vtCacheSize", static_cast<float>(m_cacheSlots * (m_header.tileSize + 2 * m_header.border)));
+}
+
+void VirtualTexture::bind(const GLuint cacheUnit) const {
+    glBindTextureUnit(cacheUnit, m_cacheTexture);
+    glBindTextureUnit(cacheUnit + 1, m_indirectionTexture);
+}
+
+void VirtualTexture::load(const uint32_t key, const bool pinned) {
+    uint32_t slot;
+    if (!m_freeSlots.empty()) {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else if (!m_lru.empty()) {
+        slot = m_lru.back(); // least recently seen
+        m_lru.pop_back();
+        m_lruPosition.erase(slot);
+        m_slotOfTile.erase(m_slots[slot].tile);
+    } else {
+        return; // every slot is pinned
+    }
+    m_slots[slot] = Slot{key, pinned};
+    m_slotOfTile[key] = slot;
+    if (!pinned) {
+        m_lru.push_front(slot);
+        m_lruPosition[slot] = m_lru.begin();
+    }
+
+    const int padded = m_header.tileSize + 2 * m_header.border;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // the page is faulted in from the mapping here, only for the tiles in use
+    glTextureSubImage2D(m_cacheTexture, 0, (slot % m_cacheSlots) * padded, (slot / m_cacheSlots) * padded, padded, padded, GL_RGB, GL_UNSIGNED_BYTE, tileData(key));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    m_indirectionDirty = true;
+    ++m_numUploads;
+}
+
+// Every entry points to its own tile when resident, otherwise to the entry of
+// its parent, filled just before since levels are visited coarsest first
+void VirtualTexture::rebuildIndirection() {
+    const int tileSize = m_header.tileSize;
+    const int width = tileCount(m_header.width, 0, tileSize);
+    for (int l = m_header.numLevels - 1; l >= 0; --l) {
+        for (int y = 0; y < tileCount(m_header.height, l, tileSize); ++y) {
+            for (int x = 0; x < tileCount(m_header.width, l, tileSize); ++x) {
+                unsigned char* entry = &m_indirection[4 * (static_cast<size_t>(m_levelRows[l] + y) * width + x)];
+                const std::unordered_map<uint32_t, uint32_t>::const_iterator resident = m_slotOfTile.find(tileKey(l, x, y));
+                if (resident != m_slotOfTile.end()) {
+                    entry[0] = static_cast<unsigned char>(resident->second % m_cacheSlots);
+                    entry[1] = static_cast<unsigned char>(resident->second / m_cacheSlots);
+                    entry[2] = static_cast<unsigned char>(l);
+                    entry[3] = 1;
+                } else {
+                    const int parentX = std::min(x / 2, tileCount(m_header.width, l + 1, tileSize) - 1);
+                    const int parentY = std::min(y / 2, tileCount(m_header.height, l + 1, tileSize) - 1);
+                    std::memcpy(entry, &m_indirection[4 * (static_cast<size_t>(m_levelRows[l + 1] + parentY) * width + parentX)], 4);
+                }
+            }
+        }
+    }
+    const int rows = static_cast<int>(m_indirection.size() / (4 * width));
+    glTextureSubImage2D(m_indirectionTexture, 0, 0, 0, width, rows, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, m_indirection.data());
+    m_indirectionDirty = false;
+}
+
+void VirtualTexture::resizeFeedback(const int width, const int height) {
+    glDeleteTextures(1, &m_feedbackTexture);
+    glDeleteRenderbuffers(1, &m_feedbackDepth);
+    glDeleteFramebuffers(1, &m_feedbackFbo);
+    m_feedbackWidth = width;
+    m_feedbackHeight = height;
+    glCreateTextures(GL_TEXTURE_2D, 1, &m_feedbackTexture);
+    glTextureStorage2D(m_feedbackTexture, 1, GL_R32UI, width, height);
+    glCreateRenderbuffers(1, &m_feedbackDepth);
+    glNamedRenderbufferStorage(m_feedbackDepth, GL_DEPTH_COMPONENT24, width, height);
+    glCreateFramebuffers(1, &m_feedbackFbo);
+    glNamedFramebufferTexture(m_feedbackFbo, GL_COLOR_ATTACHMENT0, m_feedbackTexture, 0);
+    glNamedFramebufferRenderbuffer(m_feedbackFbo, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_feedbackDepth);
+
+    // pending readbacks have the old size
+    for (int i = 0; i < 2; ++i) {
+        if (m_feedbackFences[i]) glDeleteSync(m_feedbackFences[i]);
+        m_feedbackFences[i] = nullptr;
+        glDeleteBuffers(1, &m_feedbackPbos[i]);
+        glCreateBuffers(1, &m_feedbackPbos[i]);
+        glNamedBufferStorage(m_feedbackPbos[i], sizeof(GLuint) * width * height, NULL, GL_MAP_READ_BIT | GL_CLIENT_STORAGE_BIT);
+    }
+}
+
+void VirtualTexture::beginFeedback() {
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_savedFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, m_savedViewport);
+    const int width = std::max(1, m_savedViewport[2] / kFeedbackScale), height = std::max(1, m_savedViewport[3] / kFeedbackScale);
+    if (width != m_feedbackWidth || height != m_feedbackHeight)
+        resizeFeedback(width, height);
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_feedbackFbo);
+    glViewport(0, 0, m_feedbackWidth, m_feedbackHeight);
+    const GLuint noRequest[4] = {0, 0, 0, 0};
+    glClearBufferuiv(GL_COLOR, 0, noRequest);
+    glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void VirtualTexture::endFeedback() {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_feedbackFbo);
+    if (m_synchronous) {
+        std::vector<GLuint> values(static_cast<size_t>(m_feedbackWidth) * m_feedbackHeight);
+        glReadPixels(0, 0, m_feedbackWidth, m_feedbackHeight, GL_RED_INTEGER, GL_UNSIGNED_INT, values.data());
+        decodeFeedback(values.data(), values.size());
+    } else {
+        const int slot = m_feedbackNext;
+        if (m_feedbackFences[slot]) glDeleteSync(m_feedbackFences[slot]); // never consumed: drop it
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_feedbackPbos[slot]);
+        glReadPixels(0, 0, m_feedbackWidth, m_feedbackHeight, GL_RED_INTEGER, GL_UNSIGNED_INT, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        m_feedbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_feedbackNext = 1 - slot;
+    }
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_savedFramebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_savedFramebuffer);
+    glViewport(m_savedViewport[0], m_savedViewport[1], m_savedViewport[2], m_savedViewport[3]);
+}
+
+// Feedback values: valid bit 31, level in bits 26-30, tile y in 13-25, tile x in 0-12.
+// Tiles outside the page file are dropped: the values come from the GPU and
+// index the mapping.
+void VirtualTexture::decodeFeedback(const GLuint* values, const size_t count) {
+    m_requested.clear();
+    for (size_t i = 0; i < count; ++i) {
+        if (!(values[i] & 0x80000000u))
+            continue;
+        const uint32_t key = values[i] & 0x7FFFFFFFu;
+        const int level = keyLevel(key);
+        if (level < static_cast<int>(m_header.numLevels) && keyX(key) < tileCount(m_header.width, level, m_header.tileSize)
+            && keyY(key) < tileCount(m_header.height, level, m_header.tileSize))
+            m_requested.push_back(key);
+    }
+    std::sort(m_requested.begin(), m_requested.end());
+    m_requested.erase(std::unique(m_requested.begin(), m_requested.end()), m_requested.end());
+}
+
+void VirtualTexture::update(const size_t maxUploads) {
+    if (!m_synchronous) {
+        // the latest readback, queued by the previous frame, if the GPU is done
+        // with it; otherwise the one queued two frames ago
+        const int latest = 1 - m_feedbackNext;
+        for (const int slot : {latest, m_feedbackNext}) {
+            if (!m_feedbackFences[slot] || glClientWaitSync(m_feedbackFences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+                continue;
+            glDeleteSync(m_feedbackFences[slot]);
+            m_feedbackFences[slot] = nullptr;
+            const size_t count = static_cast<size_t>(m_feedbackWidth) * m_feedbackHeight;
+            const GLuint* values = static_cast<const GLuint*>(glMapNamedBufferRange(m_feedbackPbos[slot], 0, count * sizeof(GLuint), GL_MAP_READ_BIT));
+            if (values) {
+                decodeFeedback(values, count);
+                glUnmapNamedBuffer(m_feedbackPbos[slot]);
+            }
+            if (slot == latest && m_feedbackFences[m_feedbackNext]) {
+                glDeleteSync(m_feedbackFences[m_feedbackNext]); // older than what was just read
+                m_feedbackFences[m_feedbackNext] = nullptr;
+            }
+            break;
+        }
+    }
+
+    // Seen tiles move to the front of the LRU list, missing ones are loaded coarsest first
+    std::vector<uint32_t> missing;
+    for (const uint32_t key : m_requested) {
+        const std::unordered_map<uint32_t, uint32_t>::const_iterator resident = m_slotOfTile.find(key);
+        if (resident == m_slotOfTile.end()) {
+            missing.push_back(key);
+        } else if (!m_slots[resident->second].pinned) {
+            m_lru.splice(m_lru.begin(), m_lru, m_lruPosition[resident->second]);
+        }
+    }
+    std::sort(missing.begin(), missing.end(), [](const uint32_t a, const uint32_t b) { return keyLevel(a) > keyLevel(b); });
+    const size_t budget = m_synchronous ? missing.size() : std::min(maxUploads, missing.size());
+    // never evict more than the cache holds within one update, or the first loads would be thrown out by the last ones
+    const size_t numLoads = std::min(budget, m_lru.size() + m_freeSlots.size());
+    for (size_t i = 0; i < numLoads; ++i)
+        load(missing[i], false);
+    if (m_indirectionDirty)
+        rebuildIndirection();
+}
+
+bool VirtualTexture::hasMisses() const {
+    if (!isOpen())
+        return false;
+    for (const uint32_t key : m_requested) {
+        if (m_slotOfTile.find(key) == m_slotOfTile.end())
+            return true;
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,78 @@
+#version 330 core	     // Minimal GL version support expected from the GPU
+
+// Every body, specialized by defines (CPU side: bodyShaderDefines() and initGPUprogram() in main.cpp):
+//   LIGHTING         Phong shading by the sun at the origin, unlit otherwise
+//   TEXTURE          albedo from the array layer of the body, white otherwise
+//   VIRTUAL_TEXTURE  albedo streamed from the page file instead of the array
+
+#ifdef LIGHTING
+in vec3 fNormal;
+in vec3 fPosition;
+#endif
+in vec2 fTexCoord;
+flat in uint fLayer;
+
+out vec4 color;	  // Shader output: the color response attached to this fragment
+
+#ifdef LIGHTING
+uniform vec3 lColor;
+#include "include/camera.glsl"
+#endif
+
+#if defined(VIRTUAL_TEXTURE)
+#include "include/virtual_texture.glsl"
+
+uniform sampler2D vtCache; // resident tiles, with their borders
+uniform usampler2D vtIndirection; // per tile of every level: cache slot x, y, resident level
+uniform int vtBorder;
+uniform int vtLevelRows[16]; // first row of each level in vtIndirection
+uniform float vtCacheSize; // in texels
+
+vec3 albedo() {
+	vec2 uv = vtWrap(fTexCoord);
+	int level = vtLevel(uv, 0.0);
+	ivec2 tile = vtTile(uv, level);
+	uvec4 entry = texelFetch(vtIndirection, ivec2(tile.x, vtLevelRows[level] + tile.y), 0);
+
+	// the entry may point to a coarser ancestor while the tile is streamed in
+	vec2 inLevel = uv * vtLevelSize(int(entry.z));
+	vec2 inTile = inLevel - vec2(ivec2(inLevel) / vtTileSize * vtTileSize);
+	vec2 cacheTexel = vec2(entry.xy) * float(vtTileSize + 2 * vtBorder) + float(vtBorder) + inTile;
+	return textureLod(vtCache, cacheTexel / vtCacheSize, 0.0).rgb;
+}
+#elif defined(TEXTURE)
+uniform sampler2DArray text; // albedo maps of every body, one per layer
+
+vec3 albedo() {
+	return texture(text, vec3(fTexCoord, fLayer)).rgb;
+}
+#else
+vec3 albedo() {
+	return vec3(1.0);
+}
+#endif
+
+void main() {
+	vec3 texColor = albedo();
+
+#ifdef LIGHTING
+	vec3 n = normalize(fNormal);
+	
+	vec3 l = normalize(vec3(0.0, 0.0, 0.0) - fPosition); 
+
+	vec3 v = normalize(camPos - fPosition);
+
+	vec3 r = normalize(2*dot(n,l)*n - l);
+
+	float ambientCoef = 0.2;
+
+	float diffuseCoef = max(dot(n,l),0);
+
+	float specularCoef = 0.7*pow(max(dot(v,r),0),32);
+	
+	vec3 res = (ambientCoef+diffuseCoef+specularCoef)*lColor*texColor;
+	color = vec4(res, 1.0); 
+#else
+	color = vec4(texColor, 1.0); 
+#endif
+}
@@ -0,0 +1,20 @@
+#version 330 core	     // Minimal GL version support expected from the GPU
+
+// Virtual texture feedback: the tile every fragment would sample, rendered
+// at a fraction of the screen resolution for the bodies drawn with
+// VIRTUAL_TEXTURE (CPU side: VirtualTexture)
+
+#include "include/virtual_texture.glsl"
+
+in vec2 fTexCoord;
+
+out uint feedback; // valid bit 31, level in bits 26-30, tile y in 13-25, tile x in 0-12
+
+uniform float vtLodBias; // the feedback target is smaller than the screen: log2 of the ratio, negative
+
+void main() {
+	vec2 uv = vtWrap(fTexCoord);
+	int level = vtLevel(uv, vtLodBias);
+	ivec2 tile = vtTile(uv, level);
+	feedback = 0x80000000u | (uint(level) << 26) | (uint(tile.y) << 13) | uint(tile.x);
+}
@@ -0,0 +1,7 @@
+// Included by every program (CPU side: CameraBlock, filled once per frame)
+
+layout(std140) uniform Camera {
+    mat4 viewMat;
+    mat4 projMat;
+    vec3 camPos;
+};
@@ -0,0 +1,28 @@
+// Virtual texture addressing (CPU side: VirtualTexture), shared by the
+// sampling in fShaderBody and the tile requests in fShaderFeedback
+
+uniform vec2 vtSize; // level 0 size, in texels
+uniform int vtTileSize;
+uniform int vtNumLevels;
+
+// Wraps horizontally and clamps vertically, as the page file borders do
+vec2 vtWrap(vec2 uv) {
+	return vec2(fract(uv.x), clamp(uv.y, 0.0, 1.0));
+}
+
+// Mip level of the page file seen at uv, from the screen space derivatives
+int vtLevel(vec2 uv, float lodBias) {
+	vec2 texel = uv * vtSize;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+	return clamp(int(floor(lod)), 0, vtNumLevels - 1);
+}
+
+vec2 vtLevelSize(int level) {
+	return max(floor(vtSize / float(1 << level)), vec2(1.0));
+}
+
+ivec2 vtTile(vec2 uv, int level) {
+	vec2 levelSize = vtLevelSize(level);
+	return min(ivec2(uv * levelSize) / vtTileSize, ivec2(ceil(levelSize / float(vtTileSize))) - 1);
+}
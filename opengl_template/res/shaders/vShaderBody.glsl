@@ -0,0 +1,41 @@
+#version 330 core            // Minimal GL version support expected from the GPU
+
+// Every body, specialized by defines (CPU side: bodyShaderDefines() and initGPUprogram() in main.cpp):
+//   LIGHTING     normal and world position for the fragment shader
+//   OCT_NORMALS  normals octahedral-encoded in .xy (compressed vertex layout)
+
+layout(location=0) in vec3 vPosition; // The 1st input attribute is the position (CPU side: glVertexAttrib 0)
+#ifdef LIGHTING
+layout(location=1) in vec3 vNormal; // The 2nd input attribute is the normal (CPU side: glVertexAttrib 1)
+#endif
+layout(location=2) in vec2 vTexCoord;
+layout(location=3) in mat4 vModelMat; // Per-instance model matrix (CPU side: Mesh::Instance, locations 3 to 6)
+layout(location=7) in uint vLayer; // Per-instance layer of the albedo array
+#ifdef LIGHTING
+layout(location=8) in mat3 vNormalMat; // Per-instance inverse transpose of mat3(vModelMat), computed once per body on the CPU
+
+out vec3 fNormal;
+out vec3 fPosition;
+#endif
+out vec2 fTexCoord;
+flat out uint fLayer;
+
+#include "include/camera.glsl"
+#ifdef OCT_NORMALS
+#include "include/octahedral.glsl"
+#endif
+
+void main() {
+    gl_Position = projMat * viewMat * vModelMat * vec4(vPosition, 1.0); // mandatory to rasterize properly
+#ifdef LIGHTING
+#ifdef OCT_NORMALS
+    vec3 normal = octahedralDecode(vNormal.xy);
+#else
+    vec3 normal = vNormal;
+#endif
+    fNormal = vNormalMat * normal;
+    fPosition = vec3(vModelMat * vec4(vPosition, 1.0));
+#endif
+    fTexCoord = vTexCoord;
+    fLayer = vLayer;
+}
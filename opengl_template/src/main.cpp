@@ -23,6 +23,13 @@
 #include <glm/ext.hpp>
 
 #include "mesh.h"
+#include "program.h"
+#include "scene.h"
+#include "timestep.h"
+#include "file_watcher.h"
+#include "headless.h"
+#include "texture.h"
+#include "virtual_texture.h"
 
 #include <cstdlib>
 #include <iostream>
@@ -34,6 +41,10 @@
 #include <cmath>
 #include <memory>
 #include <map>
+#include <iomanip>
+#include <cstdio>
+#include <limits>
+#include <algorithm>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -41,9 +52,41 @@
 // Window parameters
 GLFWwindow* g_window = nullptr;
 
+// Offscreen rendering parameters (--headless): frames of the time range
+// [startTime, endTime] sampled at fps are written to <outputPrefix>NNNNN.ppm
+struct HeadlessOptions {
+    bool enabled = false;
+    int width = 1024;
+    int height = 768;
+    float startTime = 0.0f;
+    float endTime = 10.0f;
+    float fps = 30.0f;
+    std::string outputPrefix = "frame_";
+};
+int g_viewportHeight = 768; // in pixels, used to turn projected sizes into pixel errors
+
 // GPU objects
-GLuint object_program = 0;
-GLuint lighting_program = 0;
+// Features of the body shader permutations, one #define each in vShaderBody and fShaderBody
+enum BodyShaderFeature : unsigned {
+    kLighting = 1u << 0,
+    kTexture = 1u << 1,
+    kVirtualTexture = 1u << 2,
+    kOctNormals = 1u << 3
+};
+std::map<unsigned, Program> bodyPrograms; // one per feature set used by a body, built at startup
+Program feedback_program; // tiles of the virtual texture seen by the camera
+const static std::string kProgramCacheDirectory = "res/cache"; // linked program binaries, skip GLSL compilation on later launches
+FileWatcher g_shaderWatcher; // shader sources edited while the app runs are compiled and swapped in
+
+// Camera data shared by every program through a std140 uniform block,
+// uploaded once per frame
+struct CameraBlock {
+    glm::mat4 viewMat;
+    glm::mat4 projMat;
+    glm::vec4 camPos; // vec3 in GLSL, padded to 16 bytes by std140
+};
+const static GLuint kCameraBlockBinding = 0;
+GLuint g_cameraUbo = 0;
 
 
 // OpenGL identifiers
@@ -54,35 +97,60 @@ GLuint g_colVbo = 0;
 
 // mesh and textures id
 std::shared_ptr<Mesh> sphere_mesh;
-GLuint g_earthTexID;
-GLuint g_moonTexID;
-GLuint g_sunTexID;
-
-// information used for camera mode selection
-enum spaceObject { outerSpace, sun, earth, moon };
-std::map<spaceObject, glm::mat4> modelMatrices;
-spaceObject cameraSpaceObject = earth;
-spaceObject lookAtSpaceObject = moon;
-
-// constants and vectors to be used in render()
-const static float kSizeSun = 1;
-const static float kSizeEarth = 0.5;
-const static float kSizeMoon = 0.25;
-const static float kRadOrbitEarth = 10;
-const static float kRadOrbitMoon = 2;
-const static float kPeriodeOrbitEarth = 30;
-const static float kPeriodeRotEarth = 0.5 * kPeriodeOrbitEarth;
-const static float kPeriodeMoon = 0.5 * kPeriodeRotEarth;
-
-const static float kDeviationEarth = glm::radians(23.5f);
-const glm::vec3 earthRotationAxe = glm::vec3(sin(kDeviationEarth), 0.0f, cos(kDeviationEarth));
+const static int kSphereMaxSubdivisions = 5; // finest icosphere of the LOD chain (20480 triangles), down to 1 (80 triangles)
+const static Mesh::VertexLayout kSphereVertexLayout = Mesh::VertexLayout::Compressed; // Interleaved (32 bytes/vertex) or Separate (one VBO per attribute) for comparison
+const static int kAlbedoArraySize = 1024; // every body albedo map is resized to this, one layer each
+const static TextureSampling kTextureSampling = {MipGeneration::Cpu, true, 8.f}; // mip source, trilinear, max anisotropy
+AsyncTextureLoader g_textureLoader(kTextureSampling); // decodes the textures while the window and the GL context are created
+VirtualTexture g_earthVirtualTexture; // earth surface streamed tile by tile, when its page file was built
+const static std::string kEarthPageFile = "res/media/earth.vtp";
+const static int kVirtualCacheSlots = 8; // the tile cache holds 8x8 tiles, whatever the size of the page file
+const static size_t kVirtualTileUploadsPerFrame = 8;
+const static GLuint kVirtualTextureUnit = 1; // tile cache, and the indirection texture on the next unit
+
+// Bodies, their orbits and their textures, from a scene file (--scene to use another one)
+Scene g_scene;
+std::string g_sceneFile = "res/scenes/solar_system.scene";
+FixedTimestep g_simulationClock; // steps of g_scene, at their own rate (--sim-rate to change it)
+const static std::string kVirtualTextureBody = "earth"; // drawn from kEarthPageFile when it exists
+std::vector<size_t> lodLevels; // per body: LOD of sphere_mesh drawn at the previous frame
+std::map<unsigned, std::vector<size_t>> bodiesByProgram; // bodies drawn with each of bodyPrograms
+
+// Scene graph work summed over the frames since the start, to check static bodies cost nothing
+struct SceneUpdateCounters {
+    size_t frames = 0;
+    size_t visited = 0;
+    size_t worldUpdates = 0;
+    size_t modelUpdates = 0;
+
+    void add(const Scene::UpdateStats& stats) {
+        ++frames;
+        visited += stats.visited;
+        worldUpdates += stats.worldUpdates;
+        modelUpdates += stats.modelUpdates;
+    }
+    void print() const {
+        const double n = frames > 0 ? static_cast<double>(frames) : 1.0;
+        std::cout << "Scene updates over " << frames << " frames (" << g_scene.size() << " bodies), per frame: "
+            << visited / n << " visited, " << worldUpdates / n << " world and " << modelUpdates / n << " model transforms" << std::endl;
+    }
+};
+SceneUpdateCounters g_sceneUpdateCounters;
+
+// information used for camera mode selection: indices in g_scene
+const static int kFreeCamera = -1;
+int cameraBody = kFreeCamera;
+int lookAtBody = kFreeCamera;
 
 const static glm::vec3 lightColor = glm::vec3(1.0, 1.0, 0.7);
 
-glm::vec3 earthOrbitalMovement = glm::vec3(0.0);
-glm::vec3 moonOrbitalMovement = glm::vec3(0.0);
 glm::vec3 freeCameraMovement = glm::vec3(0.0);
 
+// Center of a body, or the origin for kFreeCamera
+glm::vec3 bodyPosition(const int body) {
+    return body == kFreeCamera ? glm::vec3(0.0f) : g_scene.position(static_cast<size_t>(body));
+}
+
 
 // Basic camera model
 class Camera {
@@ -128,7 +196,7 @@ public:
     }
 
     inline glm::vec3 calculate_camera_pos() {
-        return glm::vec3(modelMatrices[lookAtSpaceObject] * glm::vec4(0.0, 0.0, 0.0, 1.0)) + glm::vec3(m_r * sin(m_theta) * cos(m_phi), m_r * sin(m_theta) * sin(m_phi), m_r * cos(m_theta));
+        return bodyPosition(lookAtBody) + glm::vec3(m_r * sin(m_theta) * cos(m_phi), m_r * sin(m_theta) * sin(m_phi), m_r * cos(m_theta));
     }
 
 private:
@@ -146,36 +214,10 @@ private:
 };
 Camera g_camera;
 
-GLuint loadTextureFromFileToGPU(const std::string& filename) {
-    int width, height, numComponents;
-    // Loading the image in CPU memory using stbd_image
-    unsigned char* data = stbi_load(
-        filename.c_str(),
-        &width, &height,
-        &numComponents, // 1 for a 8 bit greyscale image, 3 for 24bits RGB image, 4 for 32bits RGBA image
-        0);
-
-    GLuint texID; // OpenGL texture identifier
-    glGenTextures(1, &texID); // generate an OpenGL texture container
-    glBindTexture(GL_TEXTURE_2D, texID); // activate the texture
-    // The following lines setup the texture filtering option and repeat mode; check www.opengl.org for details.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    // fills the GPU texture with the data stored in the CPU image
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-
-    // Freeing the now useless CPU memory
-    stbi_image_free(data);
-    glBindTexture(GL_TEXTURE_2D, 0); // unbind the texture
-
-    return texID;
-}
-
 // Executed each time the window is resized. Adjust the aspect ratio and the rendering viewport to the current window.
 void windowSizeCallback(GLFWwindow* window, int width, int height) {
     g_camera.setAspectRatio(static_cast<float>(width) / static_cast<float>(height));
+    g_viewportHeight = height;
     glViewport(0, 0, (GLint)width, (GLint)height); // Dimension of the rendering region in the window
 }
 
@@ -195,33 +237,43 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
     }
     else if (action == GLFW_PRESS && (key == GLFW_KEY_J)) {
         std::cout << "J key pressed: " << "lookAtpoint = earth" << std::endl;
-        if (cameraSpaceObject != earth) { lookAtSpaceObject = earth; }
+        const int body = g_scene.find("earth");
+        if (body != kFreeCamera && cameraBody != body) { lookAtBody = body; }
     }
     else if (action == GLFW_PRESS && (key == GLFW_KEY_K)) {
         std::cout << "K key pressed: " << "lookAtpoint = moon" << std::endl;
-        if (cameraSpaceObject != moon) { lookAtSpaceObject = moon; }
+        const int body = g_scene.find("moon");
+        if (body != kFreeCamera && cameraBody != body) { lookAtBody = body; }
     }
     else if (action == GLFW_PRESS && (key == GLFW_KEY_L)) {
         std::cout << "L key pressed: " << "lookAtpoint = sun" << std::endl;
-        if (cameraSpaceObject != sun) { lookAtSpaceObject = sun; }
+        const int body = g_scene.find("sun");
+        if (body != kFreeCamera && cameraBody != body) { lookAtBody = body; }
     }
     else if (action == GLFW_PRESS && (key == GLFW_KEY_V)) {
         std::cout << "V key pressed: " << "camera position = earth" << std::endl;
-        if (lookAtSpaceObject != earth) { cameraSpaceObject = earth; }
+        const int body = g_scene.find("earth");
+        if (body != kFreeCamera && lookAtBody != body) { cameraBody = body; }
     }
     else if (action == GLFW_PRESS && (key == GLFW_KEY_B)) {
         std::cout << "B key pressed: " << "camera position = moon" << std::endl;
-        if (lookAtSpaceObject != moon) { cameraSpaceObject = moon; }
+        const int body = g_scene.find("moon");
+        if (body != kFreeCamera && lookAtBody != body) { cameraBody = body; }
     }
     else if (action == GLFW_PRESS && (key == GLFW_KEY_N)) {
         std::cout << "N key pressed: " << "camera position = sun" << std::endl;
-        if (lookAtSpaceObject != sun) { cameraSpaceObject = sun; }
+        const int body = g_scene.find("sun");
+        if (body != kFreeCamera && lookAtBody != body) { cameraBody = body; }
     }
     else if (action == GLFW_PRESS && (key == GLFW_KEY_C)) {
         std::cout << "C key pressed: " << "free camera position" << std::endl;
-        cameraSpaceObject = outerSpace;
+        cameraBody = kFreeCamera;
     }
-    else if (cameraSpaceObject == outerSpace)
+    else if (action == GLFW_PRESS && (key == GLFW_KEY_U)) {
+        std::cout << "U key pressed: " << "scene update counters" << std::endl;
+        g_sceneUpdateCounters.print();
+    }
+    else if (cameraBody == kFreeCamera)
     {
         if ((action == GLFW_REPEAT || action == GLFW_PRESS) && (key == GLFW_KEY_S)) {
             std::cout << "S key pressed: " << "increase radius" << std::endl;
@@ -287,6 +339,8 @@ void initGLFW() {
     glfwSetKeyCallback(g_window, keyCallback);
 }
 
+void initOpenGLState();
+
 void initOpenGL() {
     // Load extensions for modern OpenGL
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
@@ -295,6 +349,10 @@ void initOpenGL() {
         std::exit(EXIT_FAILURE);
     }
 
+    initOpenGLState();
+}
+
+void initOpenGLState() {
     glCullFace(GL_BACK); // Specifies the faces to cull (here the ones pointing away from the camera)
     glEnable(GL_CULL_FACE); // Enables face culling (based on the orientation defined by the CW/CCW enumeration).
     glDepthFunc(GL_LESS);   // Specify the depth test for the z-buffer
@@ -302,71 +360,116 @@ void initOpenGL() {
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // specify the background color, used any time the framebuffer is cleared
 }
 
-// Loads the content of an ASCII file in a standard C++ string
-std::string file2String(const std::string& filename) {
-    std::ifstream t(filename.c_str());
-    std::stringstream buffer;
-    buffer << t.rdbuf();
-    return buffer.str();
+std::vector<std::string> bodyShaderDefines(const unsigned features) {
+    std::vector<std::string> defines;
+    if (features & kLighting) defines.push_back("LIGHTING");
+    if (features & kTexture) defines.push_back("TEXTURE");
+    if (features & kVirtualTexture) defines.push_back("VIRTUAL_TEXTURE");
+    if (features & kOctNormals) defines.push_back("OCT_NORMALS");
+    return defines;
 }
 
-// Loads and compile a shader, before attaching it to a program
-void loadShader(GLuint program, GLenum type, const std::string& shaderFilename) {
-    GLuint shader = glCreateShader(type); // Create the shader, e.g., a vertex shader to be applied to every single vertex of a mesh
-    std::string shaderSourceString = file2String(shaderFilename); // Loads the shader source from a file to a C++ string
-    const GLchar* shaderSource = (const GLchar*)shaderSourceString.c_str(); // Interface the C++ string through a C pointer
-    glShaderSource(shader, 1, &shaderSource, NULL); // load the vertex shader code
-    glCompileShader(shader);
+std::vector<Program*> allPrograms() {
+    std::vector<Program*> programs;
+    for (std::pair<const unsigned, Program>& entry : bodyPrograms) {
+        programs.push_back(&entry.second);
+    }
+    programs.push_back(&feedback_program);
+    return programs;
+}
 
-    int  success;
-    char infoLog[512];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+// Every body gets the smallest permutation of the body shaders it needs; the
+// ones in use are all built here (or loaded from the binary cache) rather
+// than on first draw. Needs sphere_mesh and the virtual texture to be set up.
+void initGPUprogram() {
+    const unsigned meshFeatures = sphere_mesh->hasOctahedralNormals() ? kOctNormals : 0u;
+    const int virtualBody = g_earthVirtualTexture.isOpen() ? g_scene.find(kVirtualTextureBody) : -1;
+    bodiesByProgram.clear();
+    for (size_t body = 0; body < g_scene.size(); ++body) {
+        unsigned features = meshFeatures | (static_cast<int>(body) == virtualBody ? kVirtualTexture : kTexture);
+        if (g_scene.shading(body) == Scene::Shading::Lit) {
+            features |= kLighting; // light sources themselves are not lit
+        }
+        bodiesByProgram[features].push_back(body);
+    }
 
-    if (!success)
-    {
-        glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        std::cout << "ERROR::" << shaderFilename << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+    for (const std::pair<const unsigned, std::vector<size_t>>& entry : bodiesByProgram) {
+        const std::vector<std::string> defines = bodyShaderDefines(entry.first);
+        Program& program = bodyPrograms[entry.first];
+        program.create();
+        program.addShader(GL_VERTEX_SHADER, "res/shaders/vShaderBody.glsl", defines);
+        program.addShader(GL_FRAGMENT_SHADER, "res/shaders/fShaderBody.glsl", defines);
+        program.link(kProgramCacheDirectory); // The GPU program is ready to be handle streams of polygons
+        program.bindUniformBlock("Camera", kCameraBlockBinding);
     }
 
+    feedback_program.create();
+    feedback_program.addShader(GL_VERTEX_SHADER, "res/shaders/vShaderBody.glsl", bodyShaderDefines(meshFeatures));
+    feedback_program.addShader(GL_FRAGMENT_SHADER, "res/shaders/fShaderFeedback.glsl");
+    feedback_program.link(kProgramCacheDirectory);
+    feedback_program.bindUniformBlock("Camera", kCameraBlockBinding);
 
-    glAttachShader(program, shader);
-    glDeleteShader(shader);
+    glCreateBuffers(1, &g_cameraUbo);
+    glNamedBufferStorage(g_cameraUbo, sizeof(CameraBlock), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glBindBufferBase(GL_UNIFORM_BUFFER, kCameraBlockBinding, g_cameraUbo);
 }
 
 
-void check_linking(GLuint program) {
-    int  success;
-    char infoLog[512];
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(program, 512, NULL, infoLog);
-        std::cout << "ERROR::" << "linking shaders" << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+
+// Uniforms that never change after startup, set again when a program is hot reloaded
+void setConstantUniforms() {
+    // uniforms a permutation does not have are ignored
+    for (std::pair<const unsigned, Program>& entry : bodyPrograms) {
+        Program& program = entry.second;
+        program.set("lColor", lightColor);
+        program.set("text", 0);
+        program.set("vtCache", static_cast<GLint>(kVirtualTextureUnit));
+        program.set("vtIndirection", static_cast<GLint>(kVirtualTextureUnit + 1));
+        if (g_earthVirtualTexture.isOpen()) {
+            g_earthVirtualTexture.setUniforms(program);
+        }
+    }
+    if (g_earthVirtualTexture.isOpen()) {
+        g_earthVirtualTexture.setUniforms(feedback_program);
+        feedback_program.set("vtLodBias", -std::log2(static_cast<float>(VirtualTexture::kFeedbackScale)));
     }
 }
 
+// Shader hot reload: edited programs compile in the background (in parallel
+// when the driver supports it) while the previous version keeps drawing
+void watchShaders() {
+    enableParallelShaderCompile();
+    for (Program* program : allPrograms()) {
+        for (const std::string& filename : program->sourceFiles())
+            g_shaderWatcher.add(filename);
+    }
+}
 
-void initGPUprogram() {
-    object_program = glCreateProgram(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
-    loadShader(object_program, GL_VERTEX_SHADER, "res/shaders/vShaderObject.glsl");
-    loadShader(object_program, GL_FRAGMENT_SHADER, "res/shaders/fShaderObject.glsl");
-    glLinkProgram(object_program); // The main GPU program is ready to be handle streams of polygons
-    check_linking(object_program);
-
-
-    lighting_program = glCreateProgram(); // Create a GPU program, i.e., two central shaders of the graphics pipeline
-    loadShader(lighting_program, GL_VERTEX_SHADER, "res/shaders/vShaderLighting.glsl");
-    loadShader(lighting_program, GL_FRAGMENT_SHADER, "res/shaders/fShaderLighting.glsl");
-    glLinkProgram(lighting_program); // The main GPU program is ready to be handle streams of polygons
-    check_linking(lighting_program);
+void reloadShaders() {
+    bool swapped = false;
+    for (Program* program : allPrograms()) {
+        // polled before any new rebuild starts, so drivers without parallel compilation get a frame to work
+        const Program::RebuildStatus status = program->pollRebuild();
+        if (status == Program::RebuildStatus::Swapped) {
+            std::cout << "Reloaded " << program->name() << std::endl;
+            swapped = true;
+        }
+    }
+    if (swapped)
+        setConstantUniforms();
 
+    for (const std::string& filename : g_shaderWatcher.changes()) {
+        for (Program* program : allPrograms()) {
+            if (program->uses(filename))
+                program->rebuild();
+        }
+    }
 }
 
 
-
-void initCamera() {
-    int width, height;
-    glfwGetWindowSize(g_window, &width, &height);
+void initCamera(const int width, const int height) {
     g_camera.setAspectRatio(static_cast<float>(width) / static_cast<float>(height));
+    g_viewportHeight = height;
     g_camera.setNear(0.1);
     g_camera.setFar(80.1);
 }
@@ -374,30 +477,54 @@ void initCamera() {
 
 
 
-void init() {
-    modelMatrices[outerSpace] = glm::mat4(1.0);
-    modelMatrices[sun] = glm::mat4(1.0);
-    modelMatrices[earth] = glm::mat4(1.0);
-    modelMatrices[moon] = glm::mat4(1.0);
+// Programs, geometry and textures: everything that needs a current GL context but no window
+void initScene() {
+    lodLevels.assign(g_scene.size(), 0);
 
-    initGLFW();
-    initOpenGL();
+    // LOD chain of icospheres, finest first, sharing one vertex and one index buffer
+    std::vector<std::shared_ptr<Mesh>> sphereLevels;
+    std::vector<float> sphereErrors;
+    for (int subdivisions = kSphereMaxSubdivisions; subdivisions >= 1; --subdivisions) {
+        std::shared_ptr<Mesh> level = Mesh::genIcosphere(subdivisions);
+        level->optimize();
+        sphereErrors.push_back(level->computeMaxSphereError());
+        sphereLevels.push_back(level);
+    }
+    sphere_mesh = Mesh::genLodChain(sphereLevels, sphereErrors);
+    sphere_mesh->init(kSphereVertexLayout);
 
-    initGPUprogram();
+    if (g_earthVirtualTexture.open(kEarthPageFile)) {
+        g_earthVirtualTexture.initGL(kVirtualCacheSlots);
+    }
+    initGPUprogram(); // the permutations depend on the mesh layout and on the virtual texture
+    setConstantUniforms();
 
-    sphere_mesh = Mesh::genSphere(32);
-    sphere_mesh->init();
+    g_textureLoader.initGL(); // bodies are drawn with a placeholder until their texture is uploaded
 
-    g_earthTexID = loadTextureFromFileToGPU("res/media/earth.jpg");
-    g_moonTexID = loadTextureFromFileToGPU("res/media/moon.jpg");
-    g_sunTexID = loadTextureFromFileToGPU("res/media/sun.jpg");
+}
 
-    initCamera();
+void init() {
+    initGLFW();
+    initOpenGL();
+    initScene();
+    watchShaders();
+
+    int width, height;
+    glfwGetWindowSize(g_window, &width, &height);
+    initCamera(width, height);
 }
 
 void clear() {
-    glDeleteProgram(object_program);
-    glDeleteProgram(lighting_program);
+    g_textureLoader.shutdown();
+    g_shaderWatcher.close();
+    for (Program* program : allPrograms()) {
+        program->destroy();
+    }
+    bodyPrograms.clear();
+    glDeleteBuffers(1, &g_cameraUbo);
+    if (g_earthVirtualTexture.isOpen()) {
+        g_earthVirtualTexture.destroy();
+    }
 
 
     glfwDestroyWindow(g_window);
@@ -405,100 +532,301 @@ void clear() {
 }
 
 
-float calculate_phase(const float periode, const float time)
-{
-    return 2.0 * M_PI * time / periode;
+// Radius in pixels of the bounding sphere (unit sphere in model space) of a body
+float projectedRadius(const glm::mat4& modelMat, const glm::mat4& viewMat, const glm::mat4& projMat) {
+    const float radius = std::max(glm::length(glm::vec3(modelMat[0])), std::max(glm::length(glm::vec3(modelMat[1])), glm::length(glm::vec3(modelMat[2]))));
+    const float distance = glm::length(glm::vec3(viewMat * modelMat * glm::vec4(0.0, 0.0, 0.0, 1.0)));
+    if (distance <= radius) {
+        return std::numeric_limits<float>::max(); // the camera is inside the body
+    }
+    const float tanAngularRadius = radius / std::sqrt(distance * distance - radius * radius);
+    return tanAngularRadius * projMat[1][1] * 0.5f * static_cast<float>(g_viewportHeight);
 }
 
-void render() {
-
-
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Erase the color and z buffers
-
-    float time = static_cast<float>(glfwGetTime());
-
-    modelMatrices[earth] = glm::mat4(1.0f);
-
-    earthOrbitalMovement = glm::vec3(kRadOrbitEarth * cos(calculate_phase(kPeriodeOrbitEarth, time)), kRadOrbitEarth * sin(calculate_phase(kPeriodeOrbitEarth, time)), 0.0);
-    modelMatrices[earth] = glm::translate(modelMatrices[earth], earthOrbitalMovement);
+// Picks the LOD of sphere_mesh for a body, starting from the one used at the previous frame
+size_t updateLod(const size_t body, const glm::mat4& viewMat, const glm::mat4& projMat) {
+    lodLevels[body] = sphere_mesh->selectLod(projectedRadius(g_scene.model(body), viewMat, projMat), lodLevels[body]);
+    return lodLevels[body];
+}
 
-    moonOrbitalMovement = glm::vec3(kRadOrbitMoon * cos(calculate_phase(kPeriodeMoon, time)), kRadOrbitMoon * sin(calculate_phase(kPeriodeMoon, time)), 0.0);
-    modelMatrices[moon] = glm::translate(modelMatrices[earth], moonOrbitalMovement);
+// Inverse transpose of the upper 3x3 of a model matrix, used to transform normals.
+// For a similarity transform s*R (every body today) it is simply s*R / s^2,
+// so the general inverse is only computed for non-uniform scales or shears
+glm::mat3 computeNormalMatrix(const glm::mat4& modelMat) {
+    const glm::mat3 m(modelMat);
+    const float kTolerance = 1e-4f;
+    const float scale2 = glm::dot(m[0], m[0]);
+    const bool isSimilarity =
+        std::abs(glm::dot(m[1], m[1]) - scale2) <= kTolerance * scale2 &&
+        std::abs(glm::dot(m[2], m[2]) - scale2) <= kTolerance * scale2 &&
+        std::abs(glm::dot(m[0], m[1])) <= kTolerance * scale2 &&
+        std::abs(glm::dot(m[0], m[2])) <= kTolerance * scale2 &&
+        std::abs(glm::dot(m[1], m[2])) <= kTolerance * scale2;
+    if (isSimilarity && scale2 > 0.0f) {
+        return m / scale2;
+    }
+    return glm::transpose(glm::inverse(m));
+}
 
-    modelMatrices[earth] = glm::rotate(modelMatrices[earth], calculate_phase(kPeriodeRotEarth, time), earthRotationAxe);
-    modelMatrices[earth] = glm::scale(modelMatrices[earth], glm::vec3(kSizeEarth));
+// Draws bodies sharing sphere_mesh and the current program in a single
+// instanced call, each at its own LOD and with its own layer of the albedo array
+void renderBodies(const std::vector<size_t>& bodies, const glm::mat4& viewMat, const glm::mat4& projMat) {
+    std::vector<Mesh::Instance> instances(bodies.size());
+    std::vector<size_t> lods(bodies.size());
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        instances[i].modelMat = g_scene.model(bodies[i]);
+        const glm::mat3 normalMat = computeNormalMatrix(instances[i].modelMat);
+        for (int c = 0; c < 3; ++c) {
+            instances[i].normalMat[c] = glm::vec4(normalMat[c], 0.0f);
+        }
+        instances[i].layer = g_scene.texture(bodies[i]); // layers follow g_scene.textures()
+        lods[i] = updateLod(bodies[i], viewMat, projMat);
+    }
+    sphere_mesh->renderInstanced(instances, lods);
+}
 
+void render() {
 
-    modelMatrices[moon] = glm::rotate(modelMatrices[moon], calculate_phase(kPeriodeMoon, time), glm::vec3(0.0f, 0.0f, 1.0f));
 
-    modelMatrices[moon] = glm::scale(modelMatrices[moon], glm::vec3(kSizeMoon));
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Erase the color and z buffers
 
-    modelMatrices[sun] = glm::mat4(1.0f);
-    modelMatrices[sun] = glm::scale(modelMatrices[sun], glm::vec3(kSizeSun)); // a smaller cube
+    // between the two latest simulated states; only the transforms moved since the previous call
+    g_scene.update(g_simulationClock.alpha());
+    g_sceneUpdateCounters.add(g_scene.stats());
 
-    if (cameraSpaceObject == outerSpace)
+    if (cameraBody == kFreeCamera)
     {
-        modelMatrices[outerSpace] = glm::mat4(1.0f);
         freeCameraMovement = g_camera.calculate_camera_pos();
-        modelMatrices[outerSpace] = glm::translate(modelMatrices[outerSpace], freeCameraMovement);
+        g_camera.setPosition(freeCameraMovement);
+    }
+    else
+    {
+        g_camera.setPosition(bodyPosition(cameraBody));
     }
-    g_camera.setPosition(glm::vec3(modelMatrices[cameraSpaceObject] * glm::vec4(0.0, 0.0, 0.0, 1.0)));
-    g_camera.setLookAtPoint(glm::vec3(modelMatrices[lookAtSpaceObject] * glm::vec4(0.0, 0.0, 0.0, 1.0)));
+    g_camera.setLookAtPoint(bodyPosition(lookAtBody));
 
 
     const glm::mat4 viewMatrix = g_camera.computeViewMatrix();
     const glm::mat4 projMatrix = g_camera.computeProjectionMatrix();
     const glm::vec3 camPosition = g_camera.getPosition();
 
+    // one upload for every program
+    CameraBlock cameraBlock;
+    cameraBlock.viewMat = viewMatrix;
+    cameraBlock.projMat = projMatrix;
+    cameraBlock.camPos = glm::vec4(camPosition, 1.0f);
+    glNamedBufferSubData(g_cameraUbo, 0, sizeof(CameraBlock), &cameraBlock);
 
-    glUseProgram(object_program);
-
-    glUniformMatrix4fv(glGetUniformLocation(object_program, "viewMat"), 1, GL_FALSE, glm::value_ptr(viewMatrix)); // compute the view matrix of the camera and pass it to the GPU program
-    glUniformMatrix4fv(glGetUniformLocation(object_program, "projMat"), 1, GL_FALSE, glm::value_ptr(projMatrix)); // compute the projection matrix of the camera and pass it to the GPU program
-    glUniform3f(glGetUniformLocation(object_program, "camPos"), camPosition[0], camPosition[1], camPosition[2]);
-    glUniform3fv(glGetUniformLocation(object_program, "lColor"), 1, &lightColor[0]);
-
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(glGetUniformLocation(object_program, "text"), 0);
-    glBindTexture(GL_TEXTURE_2D, g_earthTexID);
+    if (g_earthVirtualTexture.isOpen()) {
+        g_earthVirtualTexture.update(kVirtualTileUploadsPerFrame); // streams the tiles seen in the previous feedback
+        g_earthVirtualTexture.bind(kVirtualTextureUnit);
+    }
 
-    glUniformMatrix4fv(glGetUniformLocation(object_program, "modelMat"), 1, GL_FALSE, glm::value_ptr(modelMatrices[earth])); // compute the model matrix
-    sphere_mesh->render();
 
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(glGetUniformLocation(object_program, "text"), 0);
-    glBindTexture(GL_TEXTURE_2D, g_moonTexID);
+    // all albedo maps live in one array texture, bound once for every program
+    glBindTextureUnit(0, g_textureLoader.arrayTexture());
 
-    glUniformMatrix4fv(glGetUniformLocation(object_program, "modelMat"), 1, GL_FALSE, glm::value_ptr(modelMatrices[moon])); // compute the model matrix
+    // one instanced draw per permutation, for the bodies that share it
+    std::vector<size_t> virtualBodies;
+    for (const std::pair<const unsigned, std::vector<size_t>>& entry : bodiesByProgram) {
+        bodyPrograms[entry.first].use();
+        renderBodies(entry.second, viewMatrix, projMatrix);
+        if (entry.first & kVirtualTexture) {
+            virtualBodies.insert(virtualBodies.end(), entry.second.begin(), entry.second.end());
+        }
+    }
 
+    if (!virtualBodies.empty()) {
+        g_earthVirtualTexture.beginFeedback();
+        feedback_program.use();
+        renderBodies(virtualBodies, viewMatrix, projMatrix);
+        g_earthVirtualTexture.endFeedback();
+    }
+}
 
-    sphere_mesh->render();
+// Update any accessible variable based on the current time
+void update(const double currentTimeInSec) {
+    // as many fixed steps as fit in the time elapsed since the previous frame, none on fast frames
+    const int steps = g_simulationClock.advance(currentTimeInSec);
+    for (int step = 0; step < steps; ++step) {
+        g_scene.step(g_simulationClock.dt());
+    }
+}
 
-    glUseProgram(lighting_program);
+HeadlessOptions parseHeadlessOptions(int argc, char** argv) {
+    HeadlessOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--headless") {
+            options.enabled = true;
+        } else if (arg == "--size" && hasValue) {
+            std::sscanf(argv[++i], "%dx%d", &options.width, &options.height);
+        } else if (arg == "--start" && hasValue) {
+            options.startTime = static_cast<float>(std::atof(argv[++i]));
+        } else if (arg == "--end" && hasValue) {
+            options.endTime = static_cast<float>(std::atof(argv[++i]));
+        } else if (arg == "--fps" && hasValue) {
+            options.fps = static_cast<float>(std::atof(argv[++i]));
+        } else if (arg == "--output" && hasValue) {
+            options.outputPrefix = argv[++i];
+        }
+    }
+    return options;
+}
 
-    glUniformMatrix4fv(glGetUniformLocation(lighting_program, "viewMat"), 1, GL_FALSE, glm::value_ptr(viewMatrix)); // compute the view matrix of the camera and pass it to the GPU program
-    glUniformMatrix4fv(glGetUniformLocation(lighting_program, "projMat"), 1, GL_FALSE, glm::value_ptr(projMatrix)); // compute the projection matrix of the camera and pass it to the GPU program
+const static std::string kDecodeCacheDirectory = "res/cache"; // decoded, resized and mipped layers, reused while the sources are unchanged
 
-    glActiveTexture(GL_TEXTURE0);
-    glUniform1i(glGetUniformLocation(object_program, "text"), 0);
-    glBindTexture(GL_TEXTURE_2D, g_sunTexID);
+// Starts decoding every texture of the scene in the background; called before any GL context exists
+void requestTextures() {
+    g_textureLoader.setArraySize(kAlbedoArraySize);
+    g_textureLoader.setDecodeCache(kDecodeCacheDirectory);
+    // one layer per texture of the scene; a converted .dds next to the image is used instead when present
+    for (size_t layer = 0; layer < g_scene.textures().size(); ++layer) {
+        g_textureLoader.enqueueLayer(g_scene.textures()[layer], static_cast<GLint>(layer));
+    }
+}
 
+// Renders the requested time range into an offscreen framebuffer and dumps every frame to disk
+int runHeadless(const HeadlessOptions& options) {
+    requestTextures();
+    if (!createHeadlessContext(options.width, options.height)) {
+        return EXIT_FAILURE;
+    }
+    initOpenGLState();
+    g_earthVirtualTexture.setSynchronousFeedback(true);
+    initScene();
+    initCamera(options.width, options.height);
+    g_simulationClock.setMaxFrameTime(std::numeric_limits<double>::infinity()); // every frame shows its exact time, however far
+    g_textureLoader.finish(); // dumped frames must never show the placeholder
+
+    FrameCapture capture;
+    capture.init(options.width, options.height);
+    const int numFrames = static_cast<int>((options.endTime - options.startTime) * options.fps) + 1;
+    for (int frame = 0; frame < numFrames; ++frame) {
+        const double time = options.startTime + static_cast<double>(frame) / options.fps;
+        update(time);
+        capture.bind();
+        render();
+        // rendered again until every tile seen is resident, as a window would after a few frames
+        for (int pass = 0; pass < 4 && g_earthVirtualTexture.hasMisses(); ++pass) {
+            render();
+        }
 
-    glUniformMatrix4fv(glGetUniformLocation(lighting_program, "modelMat"), 1, GL_FALSE, glm::value_ptr(modelMatrices[sun])); // compute the model matrix
+        std::ostringstream filename;
+        filename << options.outputPrefix << std::setw(5) << std::setfill('0') << frame << ".ppm";
+        capture.capture(filename.str());
+    }
+    capture.destroy();
+    std::cout << numFrames << " frames written to " << options.outputPrefix << "*.ppm" << std::endl;
+    g_sceneUpdateCounters.print();
 
-    sphere_mesh->render();
+    for (Program* program : allPrograms()) {
+        program->destroy();
+    }
+    bodyPrograms.clear();
+    glDeleteBuffers(1, &g_cameraUbo);
+    if (g_earthVirtualTexture.isOpen()) {
+        g_earthVirtualTexture.destroy();
+    }
+    g_textureLoader.shutdown();
+    destroyHeadlessContext();
+    return EXIT_SUCCESS;
 }
 
-// Update any accessible variable based on the current time
-void update(const float currentTimeInSec) {
-    // std::cout << currentTimeInSec << std::endl;
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--sphere-table") {
+        printSphereTessellationTable(); // triangle count vs. geometric error of the sphere generators, no window needed
+        return EXIT_SUCCESS;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--cache-check") {
+        // vertex cache optimizer on the UV sphere, no window needed
+        return printVertexCacheCheck() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--nbody-benchmark") {
+        // force kernel throughput and integrator accuracy, no window needed
+        return printNBodyBenchmark() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--barnes-hut-check") {
+        // tree forces against the direct sum, and tree costs up to 1M bodies, no window needed
+        return printBarnesHutCheck() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    // --scene FILE, --sim-rate HZ, --gravity INTEGRATOR and --theta T may come with any mode; removed from the arguments once read
+    bool gravity = false;
+    Integrator integrator = Integrator::Leapfrog;
+    float theta = 0.0f;
+    for (int i = 1; i + 1 < argc;) {
+        const std::string arg = argv[i];
+        if (arg == "--scene") {
+            g_sceneFile = argv[i + 1];
+        }
+        else if (arg == "--sim-rate" && std::atof(argv[i + 1]) > 0.0) {
+            g_simulationClock.setRate(std::atof(argv[i + 1]));
+        }
+        else if (arg == "--gravity" && (std::string(argv[i + 1]) == "leapfrog" || std::string(argv[i + 1]) == "yoshida")) {
+            gravity = true;
+            integrator = std::string(argv[i + 1]) == "leapfrog" ? Integrator::Leapfrog : Integrator::Yoshida;
+        }
+        else if (arg == "--theta" && std::atof(argv[i + 1]) >= 0.0) {
+            theta = static_cast<float>(std::atof(argv[i + 1]));
+        }
+        else {
+            ++i;
+            continue;
+        }
+        std::copy(argv + i + 2, argv + argc, argv + i);
+        argc -= 2;
+    }
+    if (!g_scene.load(g_sceneFile)) {
+        return EXIT_FAILURE;
+    }
+    if (gravity) {
+        g_scene.enableGravity(integrator, theta);
+    }
+    cameraBody = g_scene.find("earth");
+    lookAtBody = g_scene.find("moon");
+    const std::vector<std::string>& textureFiles = g_scene.textures();
+    if (argc > 1 && std::string(argv[1]) == "--mip-check") {
+        // CPU mip chains against a brute-force reference, no window needed
+        return printMipChainCheck(textureFiles) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--convert-textures") {
+        // offline asset conversion: BC1 DDS files with mips, loaded instead of the JPEGs afterwards
+        bool converted = true;
+        for (const std::string& filename : textureFiles) {
+            converted = convertTextureToDds(filename) && converted;
+        }
+        return converted ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--build-page-file") {
+        // offline tiling of the earth map for the virtual texture, used instead of the albedo array layer afterwards
+        const int body = g_scene.find(kVirtualTextureBody);
+        if (body < 0) {
+            std::cout << "ERROR: No body named " << kVirtualTextureBody << " in " << g_sceneFile << std::endl;
+            return EXIT_FAILURE;
+        }
+        return buildPageFile(textureFiles[g_scene.texture(body)], kEarthPageFile) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--bc1-check") {
+        // BC1 encoder, DDS container and decoder round trip, no GPU needed
+        return printBC1RoundTripCheck(textureFiles) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--decode-benchmark") {
+        // decode and color conversion throughput, scalar vs. SIMD, no window needed
+        return printDecodeBenchmark(textureFiles) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-}
+    const HeadlessOptions headless = parseHeadlessOptions(argc, argv);
+    if (headless.enabled) {
+        return runHeadless(headless);
+    }
 
-int main(int argc, char** argv) {
+    requestTextures();
     init(); // Your initialization code (user interface, OpenGL states, scene with geometry, material, lights, etc)
     while (!glfwWindowShouldClose(g_window)) {
-        update(static_cast<float>(glfwGetTime()));
+        g_textureLoader.uploadReady();
+        reloadShaders();
+        update(glfwGetTime());
         render();
         glfwSwapBuffers(g_window);
         glfwPollEvents();